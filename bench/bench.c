@@ -0,0 +1,71 @@
+/* Benchmark for the inline fast path of the mem_alloc library. 
+ * Compares the cost of an allocation/deallocation pair through the 
+ * exported functions with the header-inline fast path. */
+
+#define MEM_ALLOC_INLINE
+#include <mem_alloc.h>
+#include <stdio.h>
+#include <time.h>
+
+#define ITERATIONS 10000000LU
+
+typedef struct obj {
+	double x, y, z;
+} obj_t;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Keeps the compiler from eliding the allocation. */
+static inline void use(void *mem) {
+	__asm__ volatile("" : : "r"(mem) : "memory");
+}
+
+static double bench_library(void) {
+	double start = now_ns();
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		obj_t *obj = (mem_alloc)(sizeof(obj_t));
+		use(obj);
+		(mem_free)(obj);
+	}
+	return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_library_sized(void) {
+	double start = now_ns();
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		obj_t *obj = (mem_alloc)(sizeof(obj_t));
+		use(obj);
+		(mem_free_sized)(obj, sizeof(obj_t));
+	}
+	return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_inline(void) {
+	double start = now_ns();
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		obj_t *obj = mem_alloc(sizeof(obj_t));
+		use(obj);
+		mem_free_sized(obj, sizeof(obj_t));
+	}
+	return (now_ns() - start) / ITERATIONS;
+}
+
+int main(void) {
+	double library = bench_library();
+	double library_sized = bench_library_sized();
+	double inlined = bench_inline();
+
+	printf("mem_alloc + mem_free:               %6.2f ns/pair\n", library);
+	printf("mem_alloc + mem_free_sized:         %6.2f ns/pair\n", library_sized);
+	printf("inline mem_alloc + mem_free_sized:  %6.2f ns/pair\n", inlined);
+	printf("saved per call by the cache:        %6.2f ns\n",
+		(library - library_sized) / 2);
+	printf("saved per call by inlining:         %6.2f ns\n",
+		(library_sized - inlined) / 2);
+
+	return 0;
+}
@@ -0,0 +1,88 @@
+/* Benchmark for the C++ integration layer of the mem_alloc library.
+ * Builds and destroys small standard containers with the default 
+ * allocator, mem::allocator and the pmr resources. Compiled a second time
+ * with MEM_ALLOC_REPLACE_NEW, the default allocator rows measure the 
+ * replaced operator new and delete. */
+
+#include <mem_alloc.hpp>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#define ELEMENTS 1000
+#define ROUNDS 2000
+
+template <typename Fn>
+static double run(Fn fn) {
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUNDS; i++)
+		fn();
+	std::chrono::duration<double, std::micro> elapsed =
+		std::chrono::steady_clock::now() - start;
+	return elapsed.count() / ROUNDS;
+}
+
+/* Keeps the compiler from eliding the container. */
+template <typename T>
+static void use(T &container) {
+	__asm__ volatile("" : : "r"(&container) : "memory");
+}
+
+template <typename Vector>
+static void fill_vector(Vector &&vector) {
+	for (int i = 0; i < ELEMENTS; i++)
+		vector.push_back(i);
+	use(vector);
+}
+
+template <typename Map>
+static void fill_map(Map &&map) {
+	for (int i = 0; i < ELEMENTS; i++)
+		map.emplace(i, i);
+	use(map);
+}
+
+template <typename List>
+static void fill_list(List &&list) {
+	for (int i = 0; i < ELEMENTS; i++)
+		list.push_back(i);
+	use(list);
+}
+
+int main(void) {
+	using pair_t = std::pair<const int, int>;
+	using map_t = std::unordered_map<
+		int, int, std::hash<int>, std::equal_to<int>, mem::allocator<pair_t>>;
+	std::pmr::memory_resource *thread = mem::thread_arena_resource();
+	mem::arena_resource arena;
+
+#ifdef MEM_ALLOC_REPLACE_NEW
+	const char *std_label = "replaced new";
+#else
+	const char *std_label = "std::allocator";
+#endif
+
+	std::printf("%-22s %12s %12s %12s\n",
+		"us/round", "vector", "unordered_map", "list");
+	std::printf("%-22s %12.2f %12.2f %12.2f\n", std_label,
+		run([] { fill_vector(std::vector<int>()); }),
+		run([] { fill_map(std::unordered_map<int, int>()); }),
+		run([] { fill_list(std::list<int>()); }));
+	std::printf("%-22s %12.2f %12.2f %12.2f\n", "mem::allocator",
+		run([] { fill_vector(std::vector<int, mem::allocator<int>>()); }),
+		run([] { fill_map(map_t()); }),
+		run([] { fill_list(std::list<int, mem::allocator<int>>()); }));
+	std::printf("%-22s %12.2f %12.2f %12.2f\n", "pmr thread_resource",
+		run([&] { fill_vector(std::pmr::vector<int>(thread)); }),
+		run([&] { fill_map(std::pmr::unordered_map<int, int>(thread)); }),
+		run([&] { fill_list(std::pmr::list<int>(thread)); }));
+	std::printf("%-22s %12.2f %12.2f %12.2f\n", "pmr arena_resource",
+		run([&] { fill_vector(std::pmr::vector<int>(&arena)); }),
+		run([&] { fill_map(std::pmr::unordered_map<int, int>(&arena)); }),
+		run([&] { fill_list(std::pmr::list<int>(&arena)); }));
+
+	return 0;
+}
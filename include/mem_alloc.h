@@ -30,7 +30,62 @@ SOFTWARE.
 #ifndef MEM_ALLOC_H
 #define MEM_ALLOC_H
 
-#include <stddef.h> /* For size_t */
+#include <stddef.h> /* For size_t, max_align_t */
+#ifndef __cplusplus
+#include <stdalign.h> /* For alignof */
+#define MEM_ALLOC_THREAD_LOCAL _Thread_local
+#else
+/* __thread, unlike thread_local, needs no guard function on access */
+#define MEM_ALLOC_THREAD_LOCAL __thread
+extern "C" {
+#endif
+
+/******************************************************************************
+ * Public macro definitions
+ *****************************************************************************/
+
+/** The granularity of allocations. Every request is rounded up to a
+ * multiple of this value. */
+#define MEM_ALLOC_MIN_ALLOC\
+	alignof(max_align_t)
+/** The number of size classes served by the per-thread cache. Class 'n'
+ * holds blocks of exactly 'n' * MEM_ALLOC_MIN_ALLOC usable bytes. */
+#define MEM_ALLOC_TCACHE_CLASSES 16
+/** Resolves 'size' to its per-thread cache class. Folds to a constant when
+ * 'size' is a constant. */
+#define MEM_ALLOC_TCACHE_CLASS(size)\
+	(((size) + MEM_ALLOC_MIN_ALLOC - 1) / MEM_ALLOC_MIN_ALLOC)
+/** Evaluates to true if 'size' can be served by the per-thread cache. 
+ * Zero wraps around and is rejected together with the large sizes. */
+#define MEM_ALLOC_TCACHE_FITS(size)\
+	((size_t)(size) - 1 < MEM_ALLOC_TCACHE_CLASSES * MEM_ALLOC_MIN_ALLOC)
+/** The number of arena bytes a cached block of class 'cls' keeps in use, 
+ * including its metadata. */
+#define MEM_ALLOC_TCACHE_COST(cls)\
+	((cls) * MEM_ALLOC_MIN_ALLOC + 8 * sizeof(void*))
+
+/******************************************************************************
+ * Public struct definitions
+ *****************************************************************************/
+
+/** An arena that is independent of the thread's arena. */
+typedef struct arena mem_arena_t;
+
+/** Per-thread cache of blocks released with mem_free_sized(). The blocks
+ * stay allocated in the arena (or the heap) and are chained through their
+ * first bytes, so popping one requires no metadata lookup. The cache holds
+ * blocks worth at most 'limit' bytes, an eighth of the arena size. The 
+ * limit stays zero until the library has registered the hook that 
+ * releases the cache when the thread exits, so the first push of every 
+ * thread goes through the library. */
+typedef struct mem_alloc_tcache {
+	void *heads[MEM_ALLOC_TCACHE_CLASSES + 1];
+	size_t size;
+	size_t limit;
+} mem_alloc_tcache_t;
+
+/** The calling thread's cache. Exposed only for the inline fast path. */
+extern MEM_ALLOC_THREAD_LOCAL mem_alloc_tcache_t g_mem_alloc_tcache;
 
 /******************************************************************************
  * Public function forward declarations
@@ -42,12 +97,22 @@ SOFTWARE.
  * \return A pointer to the allocated memory or NULL on failure. */
 void *mem_alloc(size_t size);
 
+/** Allocates memory of 'size' bytes in the thread's cache or arena 
+ * without falling back to the heap.
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated memory or NULL if it does not fit
+ * in the arena. Memory taken from the thread's cache may still lie in the
+ * heap if it was released there with mem_free_sized(). */
+void *mem_try_alloc(size_t size);
+
 /** Deallocates memory pointed to by 'ptr'.
  * \param ptr A pointer to the memory to be freed.
  * \return 0 if heap memory was successfully unmapped,
  * 1 if the memory was at the end of the internal buffer and therefore 
  * only the offset was updated, 2 if the memory was in the middle of the
- * buffer and is now added to the free list, -1 on failure. */
+ * buffer and is now added to the free list, 4 if the memory belongs to
+ * another thread's arena and was handed back to it to be released on that
+ * thread's next call into the library, -1 on failure. */
 int mem_free(void *ptr);
 
 /** Reallocates the allocated memory pointed to by 'ptr' 
@@ -59,4 +124,100 @@ int mem_free(void *ptr);
  * possible) or NULL on failure. */
 void *mem_realloc(void *ptr, size_t size);
 
+/** Deallocates memory pointed to by 'ptr' that was allocated with 'size' 
+ * bytes. Small blocks are pushed onto the thread's cache without looking 
+ * at their metadata and are handed out again by the next allocation of the
+ * same size class.
+ * \param ptr A pointer to the memory to be freed.
+ * \param size The size that was passed to the allocating call.
+ * \return 3 if the memory was added to the thread's cache, otherwise
+ * the same values as mem_free(). */
+int mem_free_sized(void *ptr, size_t size);
+
+/** Checks whether 'ptr' lies in the arena of any thread, including
+ * threads that have exited since.
+ * \param ptr The pointer to be checked.
+ * \return 1 if 'ptr' lies in a thread's arena, 0 otherwise. */
+int mem_owns(const void *ptr);
+
+/** Creates a new arena that is independent of the thread's arena.
+ * The arena is not thread safe, callers sharing it between threads
+ * must synchronize access to it.
+ * \return A pointer to the new arena or NULL on failure. */
+mem_arena_t *mem_arena_new(void);
+
+/** Destroys an arena created with mem_arena_new(). Memory that overflowed
+ * to the heap must be freed before the arena is destroyed.
+ * \param arena A pointer to the arena to be destroyed.
+ * \return 0 on success, -1 on failure. */
+int mem_arena_delete(mem_arena_t *arena);
+
+/** Allocates memory of 'size' bytes in 'arena' or in the heap if the 
+ * arena is full.
+ * \param arena A pointer to the arena to be used for the allocation.
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated memory or NULL on failure. */
+void *mem_arena_alloc(mem_arena_t *arena, size_t size);
+
+/** Deallocates memory pointed to by 'ptr' that was allocated in 'arena'.
+ * \param arena A pointer to the arena the memory was allocated in.
+ * \param ptr A pointer to the memory to be freed.
+ * \return The same values as mem_free(). */
+int mem_arena_free(mem_arena_t *arena, void *ptr);
+
+/******************************************************************************
+ * Inline fast path
+ *****************************************************************************/
+
+#ifdef MEM_ALLOC_INLINE
+
+/** Header-inline version of mem_alloc(). When 'size' is a constant, the 
+ * size class is resolved at compile time and a cache hit costs a load and
+ * a store. The library is only called on a miss.
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated memory or NULL on failure. */
+static inline void *mem_alloc_inline(size_t size) {
+	if (MEM_ALLOC_TCACHE_FITS(size)) {
+		size_t cls = MEM_ALLOC_TCACHE_CLASS(size);
+		void *mem = g_mem_alloc_tcache.heads[cls];
+		if (mem) {
+			g_mem_alloc_tcache.heads[cls] = *(void**)mem;
+			g_mem_alloc_tcache.size -= MEM_ALLOC_TCACHE_COST(cls);
+			return mem;
+		}
+	}
+	return (mem_alloc)(size);
+}
+
+/** Header-inline version of mem_free_sized().
+ * \param ptr A pointer to the memory to be freed.
+ * \param size The size that was passed to the allocating call.
+ * \return 3 if the memory was added to the thread's cache, otherwise
+ * the same values as mem_free(). */
+static inline int mem_free_sized_inline(void *ptr, size_t size) {
+	if (ptr && MEM_ALLOC_TCACHE_FITS(size)) {
+		size_t cls = MEM_ALLOC_TCACHE_CLASS(size);
+		size_t cached_size =
+			g_mem_alloc_tcache.size + MEM_ALLOC_TCACHE_COST(cls);
+		if (cached_size <= g_mem_alloc_tcache.limit) {
+			*(void**)ptr = g_mem_alloc_tcache.heads[cls];
+			g_mem_alloc_tcache.heads[cls] = ptr;
+			g_mem_alloc_tcache.size = cached_size;
+			return 3;
+		}
+	}
+	return (mem_free_sized)(ptr, size);
+}
+
+#define mem_alloc(size)\
+	mem_alloc_inline(size)
+#define mem_free_sized(ptr, size)\
+	mem_free_sized_inline((ptr), (size))
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
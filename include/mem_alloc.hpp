@@ -0,0 +1,302 @@
+/*
+MIT License
+
+Copyright (c) 2025 broskobandi
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/** \file include/mem_alloc.hpp
+ * \brief C++ integration layer for the mem_alloc library.
+ * \details This file contains std::pmr memory resources over the thread's
+ * arena and over explicit arenas, an STL-compatible allocator and optional
+ * replacements for the global operator new and delete. Memory obtained
+ * from the thread's arena can be released on any thread, also after the
+ * allocating thread has exited. */
+
+#ifndef MEM_ALLOC_HPP
+#define MEM_ALLOC_HPP
+
+#include "mem_alloc.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+
+namespace mem {
+
+/******************************************************************************
+ * Memory resources
+ *****************************************************************************/
+
+/** Memory resource over the calling thread's arena. Requests with an
+ * alignment greater than MEM_ALLOC_MIN_ALLOC are forwarded to
+ * std::pmr::new_delete_resource(). Memory is returned to the arena that 
+ * owns it, so all instances are interchangeable across threads. */
+class thread_resource : public std::pmr::memory_resource {
+protected:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+		if (alignment > MEM_ALLOC_MIN_ALLOC)
+			return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		void *mem = mem_alloc(bytes);
+		if (!mem) throw std::bad_alloc();
+		return mem;
+	}
+
+	void do_deallocate(
+		void *ptr, std::size_t bytes, std::size_t alignment) override {
+		if (alignment > MEM_ALLOC_MIN_ALLOC)
+			std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+		else
+			mem_free_sized(ptr, bytes);
+	}
+
+	bool do_is_equal(
+		const std::pmr::memory_resource &other) const noexcept override {
+		return dynamic_cast<const thread_resource*>(&other) != nullptr;
+	}
+};
+
+/** Returns the process-wide instance of thread_resource.
+ * \return A pointer to the resource. */
+inline thread_resource *thread_arena_resource() noexcept {
+	static thread_resource resource;
+	return &resource;
+}
+
+/** Memory resource over an explicit arena owned by the resource. The arena
+ * is destroyed together with the resource. Like the arena itself, the
+ * resource is not thread safe. */
+class arena_resource : public std::pmr::memory_resource {
+public:
+	arena_resource() : arena(mem_arena_new()) {
+		if (!arena) throw std::bad_alloc();
+	}
+
+	~arena_resource() override {
+		mem_arena_delete(arena);
+	}
+
+	arena_resource(const arena_resource&) = delete;
+	arena_resource &operator=(const arena_resource&) = delete;
+
+	/** Returns the underlying arena.
+	 * \return A pointer to the arena. */
+	mem_arena_t *get() const noexcept {
+		return arena;
+	}
+
+protected:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+		if (alignment > MEM_ALLOC_MIN_ALLOC)
+			return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		void *mem = mem_arena_alloc(arena, bytes);
+		if (!mem) throw std::bad_alloc();
+		return mem;
+	}
+
+	void do_deallocate(
+		void *ptr, std::size_t bytes, std::size_t alignment) override {
+		if (alignment > MEM_ALLOC_MIN_ALLOC)
+			std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+		else
+			mem_arena_free(arena, ptr);
+	}
+
+	bool do_is_equal(
+		const std::pmr::memory_resource &other) const noexcept override {
+		return this == &other;
+	}
+
+private:
+	mem_arena_t *arena;
+};
+
+/******************************************************************************
+ * STL allocator
+ *****************************************************************************/
+
+/** STL-compatible allocator over the calling thread's arena. Memory is 
+ * returned to the arena that owns it, so all instances compare equal. */
+template <typename T>
+class allocator {
+public:
+	using value_type = T;
+
+	allocator() noexcept = default;
+
+	template <typename U>
+	allocator(const allocator<U>&) noexcept {}
+
+	T *allocate(std::size_t n) {
+		static_assert(
+			alignof(T) <= MEM_ALLOC_MIN_ALLOC,
+			"mem::allocator does not support over-aligned types");
+		if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+		void *mem = mem_alloc(n * sizeof(T));
+		if (!mem) throw std::bad_alloc();
+		return static_cast<T*>(mem);
+	}
+
+	void deallocate(T *ptr, std::size_t n) noexcept {
+		mem_free_sized(ptr, n * sizeof(T));
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T>&, const allocator<U>&) noexcept {
+	return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T>&, const allocator<U>&) noexcept {
+	return false;
+}
+
+} // namespace mem
+
+/******************************************************************************
+ * Replacements for the global operator new and delete
+ *****************************************************************************/
+
+/* Define MEM_ALLOC_REPLACE_NEW in exactly one translation unit before
+ * including this header to route small allocations of the whole program
+ * to the thread's arena. Everything else goes to malloc(). Sized deletes 
+ * put small blocks on the thread's cache, whose size is bounded, while 
+ * unsized deletes return them straight to the arena. */
+#ifdef MEM_ALLOC_REPLACE_NEW
+
+namespace mem {
+namespace detail {
+
+inline void *new_impl(std::size_t size) {
+	if (MEM_ALLOC_TCACHE_FITS(size)) {
+		void *mem = mem_try_alloc(size);
+		if (mem && mem_owns(mem)) return mem;
+		if (mem) mem_free(mem);
+	}
+	void *mem = std::malloc(size ? size : 1);
+	if (!mem) throw std::bad_alloc();
+	return mem;
+}
+
+inline void *new_aligned_impl(std::size_t size, std::align_val_t alignment) {
+	std::size_t align = static_cast<std::size_t>(alignment);
+	if (align <= MEM_ALLOC_MIN_ALLOC) return new_impl(size);
+	if (size > SIZE_MAX - align) throw std::bad_alloc();
+	void *mem = std::aligned_alloc(align, (size + align - 1) & ~(align - 1));
+	if (!mem) throw std::bad_alloc();
+	return mem;
+}
+
+inline void delete_impl(void *ptr) noexcept {
+	if (!ptr) return;
+	if (mem_owns(ptr))
+		mem_free(ptr);
+	else
+		std::free(ptr);
+}
+
+inline void delete_sized_impl(void *ptr, std::size_t size) noexcept {
+	if (!ptr) return;
+	if (mem_owns(ptr))
+		mem_free_sized(ptr, size);
+	else
+		std::free(ptr);
+}
+
+} // namespace detail
+} // namespace mem
+
+void *operator new(std::size_t size) {
+	return mem::detail::new_impl(size);
+}
+
+void *operator new[](std::size_t size) {
+	return mem::detail::new_impl(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	try {
+		return mem::detail::new_impl(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	try {
+		return mem::detail::new_impl(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+	return mem::detail::new_aligned_impl(size, alignment);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+	return mem::detail::new_aligned_impl(size, alignment);
+}
+
+void operator delete(void *ptr) noexcept {
+	mem::detail::delete_impl(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+	mem::detail::delete_impl(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t&) noexcept {
+	mem::detail::delete_impl(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept {
+	mem::detail::delete_impl(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept {
+	mem::detail::delete_sized_impl(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size) noexcept {
+	mem::detail::delete_sized_impl(ptr, size);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+	mem::detail::delete_impl(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+	mem::detail::delete_impl(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size, std::align_val_t) noexcept {
+	mem::detail::delete_sized_impl(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size, std::align_val_t) noexcept {
+	mem::detail::delete_sized_impl(ptr, size);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,170 @@
+/*
+MIT License
+
+Copyright (c) 2025 broskobandi
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/** \file include/mem_alloc_trace.h
+ * \brief Public header file for the allocation tracer of the mem_alloc
+ * library.
+ * \details This file contains the binary format of the trace file written
+ * by the library when it is built with MEM_ALLOC_TRACE defined. The file
+ * consists of a mem_trace_header_t followed by 'capacity' mem_trace_event_t
+ * slots used as a circular log: event n is stored in slot n % capacity, so
+ * once 'count' exceeds 'capacity' the file holds the last 'capacity' events
+ * written, starting at slot count % capacity. Events are written in 
+ * per-thread batches, so slot order is time order only among the events
+ * of one thread: the file holds the latest events of each thread, but an 
+ * event of one thread may be older than an overwritten event of another, 
+ * and readers must take the span of the trace from the minimum and 
+ * maximum time_ns. Events recorded by other threads after the process 
+ * has started to exit are not written, and slots that were never written
+ * are left as MEM_TRACE_NONE. */
+
+#ifndef MEM_ALLOC_TRACE_H
+#define MEM_ALLOC_TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************
+ * Public macro definitions
+ *****************************************************************************/
+
+/** The magic bytes at the start of a trace file. */
+#define MEM_TRACE_MAGIC "MEMTRACE"
+/** The version of the trace file format. */
+#define MEM_TRACE_VERSION 2
+
+/******************************************************************************
+ * Public enum definitions
+ *****************************************************************************/
+
+/** The operation recorded by an event. */
+typedef enum mem_trace_type {
+	MEM_TRACE_NONE,
+	MEM_TRACE_ALLOC,
+	MEM_TRACE_FREE,
+	MEM_TRACE_REALLOC,
+	/** Part of a snapshot of a thread's arena. A checkpoint starts with an
+	 * event of path MEM_TRACE_PATH_TAIL carrying the offset of the arena,
+	 * followed by one event per block: MEM_TRACE_PATH_BUMP for blocks in
+	 * use, MEM_TRACE_PATH_FREE_LIST for free blocks and 
+	 * MEM_TRACE_PATH_TCACHE for blocks in the thread's cache. */
+	MEM_TRACE_CHECKPOINT
+} mem_trace_type_t;
+
+/** The path taken by the allocator to serve an operation. */
+typedef enum mem_trace_path {
+	/** Allocated at the end of the arena. */
+	MEM_TRACE_PATH_BUMP,
+	/** Allocated from or freed to the free list. */
+	MEM_TRACE_PATH_FREE_LIST,
+	/** Freed to the free list and merged with a free neighbour. */
+	MEM_TRACE_PATH_COALESCE,
+	/** Allocated in or unmapped from the heap. */
+	MEM_TRACE_PATH_MMAP,
+	/** Allocated from or freed to the thread's cache. */
+	MEM_TRACE_PATH_TCACHE,
+	/** Freed at the end of the arena by lowering its offset. */
+	MEM_TRACE_PATH_TAIL,
+	/** Reallocated without changing the block. */
+	MEM_TRACE_PATH_IN_PLACE,
+	/** Reallocated by absorbing the free block that follows it. */
+	MEM_TRACE_PATH_GROW,
+	/** Reallocated by allocating, copying and freeing. */
+	MEM_TRACE_PATH_MOVE
+} mem_trace_path_t;
+
+/** Flags describing the context of an event. */
+typedef enum mem_trace_flag {
+	/** Recorded inside mem_realloc(). Replays skip these events. */
+	MEM_TRACE_FLAG_NESTED = 1,
+	/** Recorded by an explicit arena rather than the thread's arena. */
+	MEM_TRACE_FLAG_EXPLICIT_ARENA = 2,
+	/** Recorded by mem_try_alloc(). */
+	MEM_TRACE_FLAG_TRY = 4
+} mem_trace_flag_t;
+
+/******************************************************************************
+ * Public struct definitions
+ *****************************************************************************/
+
+/** The header of a trace file. */
+typedef struct mem_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+	uint64_t arena_size;
+	uint64_t mem_offset;
+	uint64_t min_alloc;
+	/** The number of event slots in the file. */
+	uint64_t capacity;
+	/** The number of events recorded in total. */
+	uint64_t count;
+	/** The number of events overwritten by newer ones. */
+	uint64_t overwritten;
+} mem_trace_header_t;
+
+/** A single allocation event. */
+typedef struct mem_trace_event {
+	/** Monotonic time of the event in nanoseconds. */
+	uint64_t time_ns;
+	/** The address returned to or passed by the caller. */
+	uint64_t addr;
+	/** The address passed to mem_realloc(), otherwise 0. */
+	uint64_t old_addr;
+	/** The address of the arena that served the event. */
+	uint64_t arena;
+	/** The size passed by the caller. */
+	uint64_t request;
+	/** The usable size of the block after the event. */
+	uint64_t block_size;
+	/** The offset of the arena after the event. */
+	uint64_t arena_offset;
+	/** The index of the thread that recorded the event. */
+	uint32_t thread;
+	uint8_t type;
+	uint8_t path;
+	uint8_t flags;
+	uint8_t reserved;
+} mem_trace_event_t;
+
+/******************************************************************************
+ * Public function forward declarations
+ *****************************************************************************/
+
+/** Waits until the events recorded by the calling thread have been 
+ * written to the trace file. Events are otherwise written by a background
+ * thread as they are recorded, and once more when the process exits.
+ * \return The number of events the calling thread recorded since its 
+ * previous call or -1 if the library was built without MEM_ALLOC_TRACE or
+ * the trace file could not be created. */
+int mem_trace_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,13 +28,46 @@ SOFTWARE.
  * and debug macros for the mem_alloc library. */
 
 #include "mem_alloc_private.h"
+#include <pthread.h>
 
 /******************************************************************************
  * Global variables
  *****************************************************************************/
 
-/** The global arena to be used as the default allocator. */
-_Thread_local static arena_t g_arena;
+/** The thread's arena to be used as the default allocator. It is acquired 
+ * on first use and handed over to the orphans when the thread exits. 
+ * The variables on the allocation path use the initial-exec TLS model, 
+ * which is cheaper to reach from the shared object and small enough to 
+ * keep the library loadable with dlopen(). */
+_Thread_local static arena_t *g_arena INITIAL_EXEC;
+
+/** Set if the thread found no arena to acquire and uses the heap only. */
+_Thread_local static bool g_is_arena_unavailable INITIAL_EXEC;
+
+/** The regions thread arenas are carved from. A region is reserved once
+ * the previous one is used up and is never unmapped, so memory that 
+ * outlives its thread still has an owner. The count is published after 
+ * the region it counts. */
+static unsigned char *g_arena_regions[MAX_ARENA_REGIONS];
+static atomic_size_t g_arena_region_count;
+static pthread_once_t g_thread_keys_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_arena_key;
+static bool g_is_arena_key_created;
+
+/** The key whose destructor releases the cache of an exiting thread that
+ * may never have acquired an arena. */
+static pthread_key_t g_tcache_key;
+static bool g_is_tcache_key_created;
+
+/** Arenas of exited threads waiting to be adopted by new threads, and the
+ * number of arenas carved from the last region. Both are guarded by the 
+ * lock. */
+static arena_t *g_orphans;
+static size_t g_arena_region_used;
+static pthread_mutex_t g_orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The per-thread cache of blocks released with mem_free_sized(). */
+_Thread_local mem_alloc_tcache_t g_mem_alloc_tcache INITIAL_EXEC;
 
 /******************************************************************************
  * Macro definitions
@@ -67,6 +100,255 @@ static inline void warn_arena_full() {
 #define WARN_ARENA_INIT
 #endif
 
+#ifdef MEM_ALLOC_TRACE
+/** Set while mem_realloc() calls other public functions. */
+_Thread_local static bool g_trace_nested INITIAL_EXEC;
+static inline uint8_t trace_flags(const arena_t *arena) {
+	return (uint8_t)(
+		(g_trace_nested ? MEM_TRACE_FLAG_NESTED : 0) |
+		(arena && arena != g_arena ? MEM_TRACE_FLAG_EXPLICIT_ARENA : 0));
+}
+#define TRACE(type, path, flags, mem, old_mem, arena, request, block_size)\
+	do {\
+		if (atomic_load_explicit(&g_trace_state, memory_order_relaxed) !=\
+			TRACE_STATE_DISABLED)\
+			trace_event(\
+				type, path, (uint8_t)(trace_flags(arena) | (flags)),\
+				mem, old_mem, arena, request, block_size);\
+	} while (0)
+#define TRACE_NESTED(nested)\
+	g_trace_nested = (nested)
+#else
+#define TRACE(type, path, flags, mem, old_mem, arena, request, block_size)
+#define TRACE_NESTED(nested)
+#endif
+
+/******************************************************************************
+ * Static helpers
+ *****************************************************************************/
+
+/** Releases the blocks in the thread's cache. Blocks of other arenas are
+ * handed back to their owners. */
+static void flush_tcache(void) {
+	g_mem_alloc_tcache.size = 0;
+	for (size_t cls = 0; cls <= MEM_ALLOC_TCACHE_CLASSES; cls++) {
+		void *mem;
+		while ((mem = g_mem_alloc_tcache.heads[cls])) {
+			g_mem_alloc_tcache.heads[cls] = *(void**)mem;
+			mem_free(mem);
+		}
+	}
+}
+
+/** Allocates memory of 'size' bytes in 'arena' or in the heap if the 
+ * arena is full.
+ * \param size The number of bytes to allocate.
+ * \param arena A pointer to the arena to be used for the allocation or
+ * NULL if the thread has no arena.
+ * \param use_heap Whether to fall back to the heap if the arena is full.
+ * \return A pointer to the allocated memory or NULL on failure. */
+static inline void *alloc_in_arena(size_t size, arena_t *arena, bool use_heap) {
+	// Larger requests cannot be mapped and would wrap the sizes below
+	if (size > MAX_REQUEST) return NULL;
+	size_t rounded_size = ROUNDUP(size, MIN_ALLOC);
+	size_t total_size = MEM_OFFSET + rounded_size;
+	size_t size_class = SIZE_CLASS(rounded_size);
+	ptr_t *ptr;
+
+	if (arena && size_class < NUM_SIZE_CLASSES && arena->free_ptr_tails[size_class]) {
+		ptr = arena->free_ptr_tails[size_class];
+		remove_from_free_list(ptr, arena);
+		ptr->is_valid = true;
+		TRACE(MEM_TRACE_ALLOC, MEM_TRACE_PATH_FREE_LIST,
+			use_heap ? 0 : MEM_TRACE_FLAG_TRY,
+			ptr->mem, NULL, arena, size, rounded_size);
+		return ptr->mem;
+	} else if (arena && arena->offset + total_size <= ARENA_SIZE) {
+		WARN_ARENA_INIT;
+		void *mem = use_arena(total_size, arena);
+		TRACE(MEM_TRACE_ALLOC, MEM_TRACE_PATH_BUMP,
+			use_heap ? 0 : MEM_TRACE_FLAG_TRY,
+			mem, NULL, arena, size, rounded_size);
+		return mem;
+	} else if (arena && arena == g_arena && g_mem_alloc_tcache.size) {
+		// Cached blocks may keep the tail from being released
+		flush_tcache();
+		return alloc_in_arena(size, arena, use_heap);
+	} else if (arena && (ptr = find_free_ptr(size_class, arena))) {
+		// The tail is full, so split a larger free pointer
+		remove_from_free_list(ptr, arena);
+		split_ptr(ptr, total_size, arena);
+		ptr->is_valid = true;
+		TRACE(MEM_TRACE_ALLOC, MEM_TRACE_PATH_FREE_LIST,
+			use_heap ? 0 : MEM_TRACE_FLAG_TRY,
+			ptr->mem, NULL, arena, size, ptr->total_size - MEM_OFFSET);
+		return ptr->mem;
+	} else {
+		if (!use_heap) return NULL;
+		WARN_ARENA_FULL;
+		void *mem = use_mmap(total_size);
+		TRACE(MEM_TRACE_ALLOC, MEM_TRACE_PATH_MMAP, 0,
+			mem, NULL, arena, size, rounded_size);
+		return mem;
+	}
+}
+
+/** Deallocates memory pointed to by 'ptr' from 'arena'.
+ * \param ptr A pointer to the memory to be freed.
+ * \param arena A pointer to the arena the memory was allocated in.
+ * \return The same values as mem_free(). */
+static inline int free_in_arena(void *ptr, arena_t *arena) {
+	if (!ptr) return -1;
+	if (!PTR(ptr)->is_valid) return -1;
+
+	if (PTR(ptr)->is_mmap) {
+		TRACE(MEM_TRACE_FREE, MEM_TRACE_PATH_MMAP, 0,
+			ptr, NULL, arena, 0, PTR(ptr)->total_size - MEM_OFFSET);
+		if (munmap(PTR(ptr), PTR(ptr)->total_size))
+			return -1;
+		return 0;
+	} else if (!PTR(ptr)->next) {
+		release_tail(PTR(ptr), arena);
+		TRACE(MEM_TRACE_FREE, MEM_TRACE_PATH_TAIL, 0,
+			ptr, NULL, arena, 0, PTR(ptr)->total_size - MEM_OFFSET);
+		return 1;
+	} else {
+#ifdef MEM_ALLOC_TRACE
+		uint8_t path = has_free_neighbour(PTR(ptr)) ?
+			MEM_TRACE_PATH_COALESCE : MEM_TRACE_PATH_FREE_LIST;
+		size_t block_size = PTR(ptr)->total_size - MEM_OFFSET;
+#endif
+		add_to_free_list(PTR(ptr), arena);
+		merge_free_ptrs(PTR(ptr), arena);
+		TRACE(MEM_TRACE_FREE, path, 0, ptr, NULL, arena, 0, block_size);
+		return 2;
+	}
+}
+
+/** Releases the memory other threads handed back to 'arena'.
+ * \param arena A pointer to the arena owned by the calling thread. */
+static void drain_remote_frees(arena_t *arena) {
+	ptr_t *ptr = atomic_exchange_explicit(
+		&arena->remote_frees, NULL, memory_order_acquire);
+	while (ptr) {
+		ptr_t *next = ptr->next_free;
+		free_in_arena(ptr->mem, arena);
+		ptr = next;
+	}
+}
+
+/** Releases the blocks in the cache of an exiting thread. The limit is 
+ * cleared, so a later push registers the hook again.
+ * \param value Unused. */
+static void release_tcache(void *value) {
+	(void)value;
+	g_mem_alloc_tcache.limit = 0;
+	flush_tcache();
+}
+
+/** Hands the arena of an exiting thread over to the orphans after 
+ * releasing the blocks in the thread's cache and the memory handed back 
+ * by other threads. Memory still in use stays valid and can be freed from
+ * any thread.
+ * \param value A pointer to the arena of the exiting thread. */
+static void release_thread_arena(void *value) {
+	arena_t *arena = (arena_t*)value;
+	release_tcache(NULL);
+	drain_remote_frees(arena);
+	g_arena = NULL;
+	pthread_mutex_lock(&g_orphans_lock);
+	arena->next_orphan = g_orphans;
+	g_orphans = arena;
+	pthread_mutex_unlock(&g_orphans_lock);
+}
+
+/** Creates the keys whose destructors hand the arena of an exiting thread
+ * over to the orphans and release its cache. */
+static void create_thread_keys(void) {
+	g_is_arena_key_created =
+		!pthread_key_create(&g_arena_key, release_thread_arena);
+	g_is_tcache_key_created =
+		!pthread_key_create(&g_tcache_key, release_tcache);
+}
+
+/** Carves a new arena from the last region, reserving a new region when
+ * it is used up. Pages are only committed once the arena touches them.
+ * The caller must hold the lock of the orphans.
+ * \return A pointer to the arena or NULL if no region can be reserved. */
+static arena_t *carve_thread_arena(void) {
+	size_t count = atomic_load_explicit(
+		&g_arena_region_count, memory_order_relaxed);
+	if (!count || g_arena_region_used == ARENAS_PER_REGION) {
+		if (count == MAX_ARENA_REGIONS) return NULL;
+		void *region = mmap(
+			NULL,
+			REGION_SIZE,
+			PROT_WRITE | PROT_READ,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE,
+			-1, 0
+		);
+		if (region == MAP_FAILED) return NULL;
+		g_arena_regions[count++] = (unsigned char*)region;
+		atomic_store_explicit(
+			&g_arena_region_count, count, memory_order_release);
+		g_arena_region_used = 0;
+	}
+	return (arena_t*)(g_arena_regions[count - 1] +
+		g_arena_region_used++ * sizeof(arena_t));
+}
+
+/** Acquires an arena for the calling thread by adopting the arena of an
+ * exited thread or by carving a new one.
+ * \return A pointer to the arena or NULL if no arena is available. */
+static arena_t *acquire_thread_arena(void) {
+	if (g_is_arena_unavailable) return NULL;
+	pthread_once(&g_thread_keys_once, create_thread_keys);
+	if (!g_is_arena_key_created) {
+		g_is_arena_unavailable = true;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&g_orphans_lock);
+	arena_t *arena = g_orphans;
+	if (arena) {
+		g_orphans = arena->next_orphan;
+		arena->next_orphan = NULL;
+	} else {
+		arena = carve_thread_arena();
+	}
+	pthread_mutex_unlock(&g_orphans_lock);
+
+	if (!arena) {
+		g_is_arena_unavailable = true;
+		return NULL;
+	}
+	g_arena = arena;
+	pthread_setspecific(g_arena_key, arena);
+	return arena;
+}
+
+/** Returns the calling thread's arena after releasing the memory other
+ * threads handed back to it.
+ * \return A pointer to the arena or NULL if the thread has no arena. */
+static inline arena_t *thread_arena(void) {
+	arena_t *arena = g_arena;
+	if (!arena && !(arena = acquire_thread_arena()))
+		return NULL;
+	if (atomic_load_explicit(&arena->remote_frees, memory_order_relaxed))
+		drain_remote_frees(arena);
+	return arena;
+}
+
+/** Registers the hook that releases the thread's cache when the thread 
+ * exits and opens the cache for pushes. The cache stays closed if the hook
+ * cannot be registered. */
+static void register_tcache(void) {
+	pthread_once(&g_thread_keys_once, create_thread_keys);
+	if (g_is_tcache_key_created &&
+		!pthread_setspecific(g_tcache_key, &g_mem_alloc_tcache))
+		g_mem_alloc_tcache.limit = TCACHE_LIMIT;
+}
+
 /******************************************************************************
  * Helpers for the test utility
  *****************************************************************************/
@@ -74,13 +356,14 @@ static inline void warn_arena_full() {
 /** For the test utility: Returns a pointer to the global arena.
  * \return A pointer to the global arena. */
 arena_t *global_arena() {
-	return &g_arena;
+	return thread_arena();
 }
 
 /** For the test utility: Resets the global arena to its default 
  * sate. */
 void reset_global_arena() {
-	memset(&g_arena, 0, sizeof(arena_t));
+	memset(thread_arena(), 0, sizeof(arena_t));
+	memset(&g_mem_alloc_tcache, 0, sizeof(mem_alloc_tcache_t));
 }
 
 /******************************************************************************
@@ -92,49 +375,52 @@ void reset_global_arena() {
  * \param size The number of bytes to allocate.
  * \return A pointer to the allocated memory or NULL on failure. */
 void *mem_alloc(size_t size) {
-	size_t total_size = MEM_OFFSET + ROUNDUP(size, MIN_ALLOC);
-	ptr_t **free_tail = &g_arena.free_ptr_tails[SIZE_CLASS(size)];
+	void *cached = tcache_pop(size, &g_mem_alloc_tcache);
+	if (cached) {
+		TRACE(MEM_TRACE_ALLOC, MEM_TRACE_PATH_TCACHE, 0,
+			cached, NULL, g_arena, size, ROUNDUP(size, MIN_ALLOC));
+		return cached;
+	}
+	return alloc_in_arena(size, thread_arena(), true);
+}
 
-	if (g_arena.offset + total_size > ARENA_SIZE) {
-		WARN_ARENA_FULL;
-		return use_mmap(total_size);
-	} else if (*free_tail) {
-		ptr_t *ptr = *free_tail;
-		*free_tail = ptr->prev_free;
-		return ptr->mem;
-	} else {
-		WARN_ARENA_INIT;
-		return use_arena(total_size, &g_arena);
+/** Allocates memory of 'size' bytes in the thread's cache or arena 
+ * without falling back to the heap.
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated memory or NULL if it does not fit
+ * in the arena. Memory taken from the thread's cache may still lie in the
+ * heap if it was released there with mem_free_sized(). */
+void *mem_try_alloc(size_t size) {
+	void *cached = tcache_pop(size, &g_mem_alloc_tcache);
+	if (cached) {
+		TRACE(MEM_TRACE_ALLOC, MEM_TRACE_PATH_TCACHE, MEM_TRACE_FLAG_TRY,
+			cached, NULL, g_arena, size, ROUNDUP(size, MIN_ALLOC));
+		return cached;
 	}
-	return NULL;
+	return alloc_in_arena(size, thread_arena(), false);
 }
 
-/** Deallocates memory pointed to by 'ptr'.
+/** Deallocates memory pointed to by 'ptr'. Memory owned by the arena of
+ * another thread is handed back to that arena, including arenas of threads
+ * that have already exited.
  * \param ptr A pointer to the memory to be freed.
  * \return 0 if heap memory was successfully unmapped,
  * 1 if the memory was at the end of the internal buffer and therefore 
  * only the offset was updated, 2 if the memory was in the middle of the
- * buffer and is now added to the free list, -1 on failure. */
+ * buffer and is now added to the free list, 4 if the memory was handed 
+ * back to the arena of another thread, -1 on failure. */
 int mem_free(void *ptr) {
 	if (!ptr) return -1;
 	if (!PTR(ptr)->is_valid) return -1;
 
-	if (PTR(ptr)->is_mmap) {
-		if (munmap(PTR(ptr), PTR(ptr)->total_size))
-			return -1;
-		return 0;
-	} else if (!PTR(ptr)->next) {
-		if (PTR(ptr)->prev)
-			PTR(ptr)->prev->next = NULL;
-		g_arena.offset -= PTR(ptr)->total_size;
-		PTR(ptr)->is_valid = false;
-		g_arena.ptrs_tail = g_arena.ptrs_tail->prev;
-		return 1;
-	} else {
-		add_to_free_list(PTR(ptr), &g_arena);
-		merge_free_ptrs(PTR(ptr), &g_arena);
-		return 2;
+	// Threads without an arena, such as exiting ones, do not acquire one
+	arena_t *owner = PTR(ptr)->arena;
+	arena_t *arena = g_arena ? thread_arena() : NULL;
+	if (owner && owner != arena && !owner->is_explicit) {
+		push_remote_free(PTR(ptr), owner);
+		return 4;
 	}
+	return free_in_arena(ptr, owner ? owner : arena);
 }
 
 /** Reallocates the allocated memory pointed to by 'ptr' 
@@ -147,25 +433,120 @@ int mem_free(void *ptr) {
 void *mem_realloc(void *ptr, size_t size) {
 	if (!ptr) return NULL;
 	if (!PTR(ptr)->is_valid) return NULL;
+	if (size > MAX_REQUEST) return NULL;
 
 	size_t total_size = MEM_OFFSET + ROUNDUP(size, MIN_ALLOC);
+	arena_t *owner = PTR(ptr)->arena;
+	arena_t *arena = thread_arena();
 
 	if (PTR(ptr)->total_size >= total_size) {
+		TRACE(MEM_TRACE_REALLOC, MEM_TRACE_PATH_IN_PLACE, 0,
+			ptr, ptr, owner ? owner : arena,
+			size, PTR(ptr)->total_size - MEM_OFFSET);
 		return ptr;
 	} else if (
+		owner && (owner == arena || owner->is_explicit) &&
 		PTR(ptr)->next && !PTR(ptr)->next->is_valid &&
 		PTR(ptr)->next->total_size + PTR(ptr)->total_size >= total_size
 	) {
-		if (mem_free(ptr) != 2) return NULL;
-		PTR(ptr)->is_valid = true;
+		remove_from_free_list(PTR(ptr)->next, owner);
+		absorb_next(PTR(ptr), owner);
+		TRACE(MEM_TRACE_REALLOC, MEM_TRACE_PATH_GROW, 0,
+			ptr, ptr, owner, size, PTR(ptr)->total_size - MEM_OFFSET);
 		return ptr;
 	} else {
-		size_t size_to_copy =
-			PTR(ptr)->total_size > total_size ?
-			total_size : PTR(ptr)->total_size;
+		size_t size_to_copy = PTR(ptr)->total_size - MEM_OFFSET;
+		TRACE_NESTED(true);
 		void *new_mem = mem_alloc(size);
-		if (!new_mem) return NULL;
-		memcpy(new_mem, PTR(ptr)->mem, size_to_copy);
+		if (new_mem) {
+			memcpy(new_mem, ptr, size_to_copy);
+			mem_free(ptr);
+		}
+		TRACE_NESTED(false);
+		TRACE(MEM_TRACE_REALLOC, MEM_TRACE_PATH_MOVE, 0,
+			new_mem, ptr, arena, size, ROUNDUP(size, MIN_ALLOC));
 		return new_mem;
 	}
 }
+
+/** Deallocates memory pointed to by 'ptr' that was allocated with 'size' 
+ * bytes. Small blocks are pushed onto the thread's cache without looking 
+ * at their metadata and are handed out again by the next allocation of the
+ * same size class.
+ * \param ptr A pointer to the memory to be freed.
+ * \param size The size that was passed to the allocating call.
+ * \return 3 if the memory was added to the thread's cache, otherwise
+ * the same values as mem_free(). */
+int mem_free_sized(void *ptr, size_t size) {
+	if (!ptr) return -1;
+	if (!g_mem_alloc_tcache.limit && MEM_ALLOC_TCACHE_FITS(size))
+		register_tcache();
+	if (tcache_push(ptr, size, &g_mem_alloc_tcache)) {
+		TRACE(MEM_TRACE_FREE, MEM_TRACE_PATH_TCACHE, 0,
+			ptr, NULL, g_arena, size, ROUNDUP(size, MIN_ALLOC));
+		return 3;
+	}
+	return mem_free(ptr);
+}
+
+/** Creates a new arena that is independent of the thread's arena.
+ * The arena is not thread safe, callers sharing it between threads
+ * must synchronize access to it.
+ * \return A pointer to the new arena or NULL on failure. */
+mem_arena_t *mem_arena_new(void) {
+	arena_t *arena = (arena_t*)mmap(
+		NULL,
+		sizeof(arena_t),
+		PROT_WRITE | PROT_READ,
+		MAP_ANONYMOUS | MAP_PRIVATE,
+		-1, 0
+	);
+	if (arena == MAP_FAILED) return NULL;
+	arena->is_explicit = true;
+	return arena;
+}
+
+/** Destroys an arena created with mem_arena_new(). Memory that overflowed
+ * to the heap must be freed before the arena is destroyed.
+ * \param arena A pointer to the arena to be destroyed.
+ * \return 0 on success, -1 on failure. */
+int mem_arena_delete(mem_arena_t *arena) {
+	if (!arena) return -1;
+	if (munmap(arena, sizeof(arena_t))) return -1;
+	return 0;
+}
+
+/** Allocates memory of 'size' bytes in 'arena' or in the heap if the 
+ * arena is full.
+ * \param arena A pointer to the arena to be used for the allocation.
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated memory or NULL on failure. */
+void *mem_arena_alloc(mem_arena_t *arena, size_t size) {
+	if (!arena) return NULL;
+	return alloc_in_arena(size, arena, true);
+}
+
+/** Deallocates memory pointed to by 'ptr' that was allocated in 'arena'.
+ * \param arena A pointer to the arena the memory was allocated in.
+ * \param ptr A pointer to the memory to be freed.
+ * \return The same values as mem_free(). */
+int mem_arena_free(mem_arena_t *arena, void *ptr) {
+	if (!arena) return -1;
+	return free_in_arena(ptr, arena);
+}
+
+/** Checks whether 'ptr' lies in the arena of any thread. Such memory can
+ * be freed with mem_free() on any thread.
+ * \param ptr The pointer to be checked.
+ * \return 1 if 'ptr' lies in the arena of a thread, 0 otherwise. */
+int mem_owns(const void *ptr) {
+	size_t count = atomic_load_explicit(
+		&g_arena_region_count, memory_order_acquire);
+	uintptr_t mem = (uintptr_t)ptr;
+	for (size_t i = 0; i < count; i++) {
+		uintptr_t region = (uintptr_t)g_arena_regions[i];
+		if (mem >= region && mem < region + REGION_SIZE)
+			return 1;
+	}
+	return 0;
+}
@@ -31,8 +31,11 @@ SOFTWARE.
 #define MEM_ALLOC_PRIVATE_H
 
 #include "mem_alloc.h"
+#include "mem_alloc_trace.h"
 #include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/mman.h>
 #include <string.h>
 #include <unistd.h>
@@ -48,18 +51,38 @@ SOFTWARE.
 #else
 #define ARENA_SIZE ARENA_SIZE_DEFAULT * ARENA_SIZE_MULTIPLIER
 #endif
+#ifndef ARENAS_PER_REGION
+#define ARENAS_PER_REGION\
+	64
+#endif
+#ifndef MAX_ARENA_REGIONS
+#define MAX_ARENA_REGIONS\
+	256
+#endif
+#define REGION_SIZE\
+	(ARENAS_PER_REGION * sizeof(arena_t))
+#define INITIAL_EXEC\
+	__attribute__((tls_model("initial-exec")))
 #define ROUNDUP(size, to)\
 	(((size) + (to) - 1) & ~((to) - 1))
 #define MIN_ALLOC\
-	alignof(max_align_t)
+	MEM_ALLOC_MIN_ALLOC
 #define MEM_OFFSET\
 	ROUNDUP(sizeof(ptr_t), MIN_ALLOC)
+#define MAX_REQUEST\
+	PTRDIFF_MAX
 #define PTR(mem)\
 	((ptr_t*)((unsigned char*)(mem) - MEM_OFFSET))
 #define NUM_SIZE_CLASSES\
 	(ARENA_SIZE - MEM_OFFSET) / MIN_ALLOC
 #define SIZE_CLASS(size)\
 	(size) / MIN_ALLOC
+#define FREE_CLASS_WORDS\
+	((NUM_SIZE_CLASSES + 63) / 64)
+#define FREE_SUMMARY_WORDS\
+	((FREE_CLASS_WORDS + 63) / 64)
+#define TCACHE_LIMIT\
+	(ARENA_SIZE / 8)
 
 /******************************************************************************
  * Struct definitions
@@ -75,15 +98,25 @@ struct ptr {
 	ptr_t *prev;
 	ptr_t *next_free;
 	ptr_t *prev_free;
+	arena_t *arena;
 	bool is_valid;
 	bool is_mmap;
 };
 
+_Static_assert(
+	MEM_ALLOC_TCACHE_COST(0) == MEM_OFFSET,
+	"MEM_ALLOC_TCACHE_COST() must account for the metadata of a block");
+
 struct arena {
 	alignas(max_align_t) unsigned char buff[ARENA_SIZE];
 	ptr_t *free_ptr_tails[NUM_SIZE_CLASSES];
+	uint64_t free_classes[FREE_CLASS_WORDS];
+	uint64_t free_summary[FREE_SUMMARY_WORDS];
 	ptr_t *ptrs_tail;
 	size_t offset;
+	_Atomic(ptr_t*) remote_frees;
+	arena_t *next_orphan;
+	bool is_explicit;
 };
 
 /******************************************************************************
@@ -93,6 +126,24 @@ struct arena {
 arena_t *global_arena();
 void reset_global_arena();
 
+/******************************************************************************
+ * Forward declarations of the tracer functions.
+ *****************************************************************************/
+
+#ifdef MEM_ALLOC_TRACE
+/** The states of the tracer. It is started by the first event. */
+#define TRACE_STATE_UNINIT 0
+#define TRACE_STATE_ENABLED 1
+#define TRACE_STATE_DISABLED 2
+extern atomic_int g_trace_state;
+void trace_event(
+	uint8_t type, uint8_t path, uint8_t flags,
+	const void *mem, const void *old_mem, const arena_t *arena,
+	size_t request, size_t block_size);
+size_t trace_buffer(mem_trace_event_t *events, size_t count);
+void trace_checkpoint(const arena_t *arena);
+#endif
+
 /******************************************************************************
  * Helper functions used by the public functions.
  *****************************************************************************/
@@ -110,10 +161,11 @@ static inline void *use_mmap(size_t total_size) {
 		MAP_ANONYMOUS | MAP_PRIVATE,
 		-1, 0
 	);
-	if (!ptr) return NULL;
+	if (ptr == MAP_FAILED) return NULL;
 
 	ptr->is_mmap = true;
 	ptr->is_valid = true;
+	ptr->arena = NULL;
 	ptr->next = NULL;
 	ptr->prev = NULL;
 	ptr->next_free = NULL;
@@ -138,6 +190,7 @@ static inline void *use_arena(size_t total_size, arena_t *arena) {
 	ptr->total_size = total_size;
 	ptr->is_valid = true;
 	ptr->is_mmap = false;
+	ptr->arena = arena;
 	ptr->next = NULL;
 	ptr_t **tail = &arena->ptrs_tail;
 	if (*tail) {
@@ -160,15 +213,16 @@ static inline void *use_arena(size_t total_size, arena_t *arena) {
  * \param arena A pointer to the arena in use. */
 static inline void add_to_free_list(ptr_t *ptr, arena_t *arena) {
 	ptr->is_valid = false;
-	ptr_t **free_tail =
-		&arena->free_ptr_tails[SIZE_CLASS(ptr->total_size - MEM_OFFSET)];
-	if (*free_tail) {
-		ptr->prev_free = *free_tail;
+	size_t size_class = SIZE_CLASS(ptr->total_size - MEM_OFFSET);
+	ptr_t **free_tail = &arena->free_ptr_tails[size_class];
+	ptr->next_free = NULL;
+	ptr->prev_free = *free_tail;
+	if (*free_tail)
 		(*free_tail)->next_free = ptr;
-		*free_tail = ptr;
-	} else {
-		*free_tail = ptr;
-	}
+	*free_tail = ptr;
+	size_t word = size_class / 64;
+	arena->free_classes[word] |= UINT64_C(1) << (size_class % 64);
+	arena->free_summary[word / 64] |= UINT64_C(1) << (word % 64);
 }
 
 /** Removes pointer metadata from the free list.
@@ -177,15 +231,90 @@ static inline void add_to_free_list(ptr_t *ptr, arena_t *arena) {
  * \param ptr A pointer to the metadata to be removed from the free list.
  * \param arena A pointer to the arena in use. */
 static inline void remove_from_free_list(ptr_t *ptr, arena_t *arena) {
-	ptr_t **free_tail = 
-		&arena->free_ptr_tails[SIZE_CLASS(ptr->total_size - MEM_OFFSET)];
+	size_t size_class = SIZE_CLASS(ptr->total_size - MEM_OFFSET);
+	ptr_t **free_tail = &arena->free_ptr_tails[size_class];
 	if (*free_tail == ptr)
 		*free_tail = (*free_tail)->prev_free;
+	if (!*free_tail) {
+		size_t word = size_class / 64;
+		arena->free_classes[word] &= ~(UINT64_C(1) << (size_class % 64));
+		if (!arena->free_classes[word])
+			arena->free_summary[word / 64] &= ~(UINT64_C(1) << (word % 64));
+	}
 	if (ptr->next_free)
 		ptr->next_free->prev_free = ptr->prev_free;
 	if (ptr->prev_free)
 		ptr->prev_free->next_free = ptr->next_free;
-		
+	ptr->next_free = NULL;
+	ptr->prev_free = NULL;
+}
+
+/** Finds a free pointer of at least 'size_class'. The classes holding 
+ * free pointers are looked up in the bitmap of the arena, whose non-empty
+ * words are in turn looked up in its summary.
+ * \param size_class The smallest size class to be considered.
+ * \param arena A pointer to the arena in use.
+ * \return The last freed pointer of the smallest matching class or NULL
+ * if the free list holds none. */
+static inline ptr_t *find_free_ptr(size_t size_class, arena_t *arena) {
+	if (size_class >= NUM_SIZE_CLASSES) return NULL;
+	size_t word = size_class / 64;
+	uint64_t bits =
+		arena->free_classes[word] & (~UINT64_C(0) << (size_class % 64));
+	if (!bits) {
+		if (++word == FREE_CLASS_WORDS) return NULL;
+		size_t summary_word = word / 64;
+		uint64_t summary = arena->free_summary[summary_word] &
+			(~UINT64_C(0) << (word % 64));
+		while (!summary) {
+			if (++summary_word == FREE_SUMMARY_WORDS) return NULL;
+			summary = arena->free_summary[summary_word];
+		}
+		word = summary_word * 64 + (size_t)__builtin_ctzll(summary);
+		bits = arena->free_classes[word];
+	}
+	return arena->free_ptr_tails[word * 64 + (size_t)__builtin_ctzll(bits)];
+}
+
+/** Shrinks 'ptr' to 'total_size' bytes and adds the rest to the free list
+ * as a pointer of its own, unless the rest is too small to hold one.
+ * This functions assumes that all arguments
+ * passed to it were validated by the caller.
+ * \param ptr A pointer to the metadata to be split.
+ * \param total_size The total size 'ptr' is to keep.
+ * \param arena A pointer to the arena in use. */
+static inline void split_ptr(ptr_t *ptr, size_t total_size, arena_t *arena) {
+	if (ptr->total_size - total_size < MEM_OFFSET + MIN_ALLOC) return;
+	ptr_t *rest = (ptr_t*)((unsigned char*)ptr + total_size);
+	rest->mem = (void*)((unsigned char*)rest + MEM_OFFSET);
+	rest->total_size = ptr->total_size - total_size;
+	rest->is_mmap = false;
+	rest->arena = arena;
+	rest->prev = ptr;
+	rest->next = ptr->next;
+	if (ptr->next)
+		ptr->next->prev = rest;
+	else
+		arena->ptrs_tail = rest;
+	ptr->next = rest;
+	ptr->total_size = total_size;
+	add_to_free_list(rest, arena);
+}
+
+/** Unlinks the metadata following 'ptr' from the list of pointers and 
+ * adds its size to 'ptr'.
+ * This functions assumes that all arguments
+ * passed to it were validated by the caller.
+ * \param ptr A pointer to the metadata to absorb its successor.
+ * \param arena A pointer to the arena in use. */
+static inline void absorb_next(ptr_t *ptr, arena_t *arena) {
+	ptr_t *next = ptr->next;
+	ptr->total_size += next->total_size;
+	ptr->next = next->next;
+	if (ptr->next)
+		ptr->next->prev = ptr;
+	else
+		arena->ptrs_tail = ptr;
 }
 
 /** Merges neighbouring free pointers.
@@ -196,27 +325,99 @@ static inline void remove_from_free_list(ptr_t *ptr, arena_t *arena) {
 static inline void merge_free_ptrs(ptr_t *ptr, arena_t *arena) {
 	if (ptr->next && !ptr->next->is_valid) {
 		remove_from_free_list(ptr->next, arena);
-		size_t new_total_size = ptr->total_size + ptr->next->total_size;
-		if (ptr->next->next) {
-			ptr->next->next->prev = ptr;
-			ptr->next = ptr->next->next;
-		}
 		remove_from_free_list(ptr, arena);
-		ptr->total_size = new_total_size;
+		absorb_next(ptr, arena);
 		add_to_free_list(ptr, arena);
 	}
 	if (ptr->prev && !ptr->prev->is_valid) {
+		ptr_t *prev = ptr->prev;
 		remove_from_free_list(ptr, arena);
-		size_t new_total_size = ptr->prev->total_size + ptr->total_size;
-		if (ptr->next) {
-			ptr->prev->next = ptr->next;
-			ptr->next->prev = ptr->prev;
-		}
-		remove_from_free_list(ptr->prev, arena);
-		ptr->prev->total_size = new_total_size;
-		add_to_free_list(ptr->prev, arena);
+		remove_from_free_list(prev, arena);
+		absorb_next(prev, arena);
+		add_to_free_list(prev, arena);
 	}
-		
+}
+
+/** Checks whether merge_free_ptrs() would merge 'ptr' with a neighbour.
+ * \param ptr A pointer to the metadata to be checked.
+ * \return true if either neighbour of 'ptr' is free. */
+static inline bool has_free_neighbour(const ptr_t *ptr) {
+	return
+		(ptr->next && !ptr->next->is_valid) ||
+		(ptr->prev && !ptr->prev->is_valid);
+}
+
+/** Removes the last pointer from the arena and returns its memory to the
+ * unused part of the buffer. A free pointer that becomes the last one is
+ * released as well.
+ * This functions assumes that all arguments
+ * passed to it were validated by the caller.
+ * \param ptr A pointer to the last metadata in the arena.
+ * \param arena A pointer to the arena in use. */
+static inline void release_tail(ptr_t *ptr, arena_t *arena) {
+	ptr->is_valid = false;
+	arena->offset -= ptr->total_size;
+	arena->ptrs_tail = ptr->prev;
+	if (ptr->prev)
+		ptr->prev->next = NULL;
+	ptr_t *tail = arena->ptrs_tail;
+	if (tail && !tail->is_valid) {
+		remove_from_free_list(tail, arena);
+		arena->offset -= tail->total_size;
+		arena->ptrs_tail = tail->prev;
+		if (tail->prev)
+			tail->prev->next = NULL;
+	}
+}
+
+/** Hands pointer metadata back to the arena that owns it from a thread 
+ * other than the owner. The owning thread releases the memory on its next
+ * call into the library.
+ * This functions assumes that all arguments
+ * passed to it were validated by the caller.
+ * \param ptr A pointer to the metadata to be handed back.
+ * \param arena A pointer to the arena that owns 'ptr'. */
+static inline void push_remote_free(ptr_t *ptr, arena_t *arena) {
+	ptr_t *head = atomic_load_explicit(&arena->remote_frees, memory_order_relaxed);
+	do {
+		ptr->next_free = head;
+	} while (!atomic_compare_exchange_weak_explicit(
+		&arena->remote_frees, &head, ptr,
+		memory_order_release, memory_order_relaxed));
+}
+
+/** Pops a block from the thread's cache.
+ * \param size The number of bytes requested.
+ * \param tcache A pointer to the cache in use.
+ * \return A pointer to the cached memory or NULL if the cache holds 
+ * no block of the matching size class. */
+static inline void *tcache_pop(size_t size, mem_alloc_tcache_t *tcache) {
+	if (!MEM_ALLOC_TCACHE_FITS(size)) return NULL;
+	size_t cls = MEM_ALLOC_TCACHE_CLASS(size);
+	void *mem = tcache->heads[cls];
+	if (mem) {
+		tcache->heads[cls] = *(void**)mem;
+		tcache->size -= MEM_ALLOC_TCACHE_COST(cls);
+	}
+	return mem;
+}
+
+/** Pushes a block onto the thread's cache.
+ * This functions assumes that all arguments
+ * passed to it were validated by the caller.
+ * \param ptr A pointer to the memory to be cached.
+ * \param size The number of bytes the memory was allocated with.
+ * \param tcache A pointer to the cache in use.
+ * \return true if the memory was cached, false if the size class is
+ * not served by the cache or the cache is full. */
+static inline bool tcache_push(void *ptr, size_t size, mem_alloc_tcache_t *tcache) {
+	if (!MEM_ALLOC_TCACHE_FITS(size)) return false;
+	size_t cls = MEM_ALLOC_TCACHE_CLASS(size);
+	if (tcache->size + MEM_ALLOC_TCACHE_COST(cls) > tcache->limit) return false;
+	*(void**)ptr = tcache->heads[cls];
+	tcache->heads[cls] = ptr;
+	tcache->size += MEM_ALLOC_TCACHE_COST(cls);
+	return true;
 }
 
 #endif
@@ -0,0 +1,574 @@
+/*
+MIT License
+
+Copyright (c) 2025 broskobandi
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/** \file src/mem_alloc_trace.c
+ * \brief Implementation of the allocation tracer of the mem_alloc library.
+ * \details Events are recorded into a ring owned by the recording thread,
+ * with a single producer and a single consumer, so recording needs no 
+ * locks and no system calls. A background thread drains the rings into the
+ * memory mapped trace file, waking up when a ring is half full, when a 
+ * thread asks for a flush and every few milliseconds. A thread whose ring
+ * is full yields until the flusher has made room. The file is used as a 
+ * circular log: once it is full, the oldest events are overwritten. 
+ * Whenever the log advances by an eighth of its capacity, each thread 
+ * follows its next event with a checkpoint of the occupancy of its arena, 
+ * so the analyzer can reconstruct arenas from the middle of the stream. 
+ * On x86 events are stamped with the time stamp counter, which the flusher
+ * converts to nanoseconds against CLOCK_MONOTONIC. The tracer is compiled
+ * only when MEM_ALLOC_TRACE is defined. The path of the trace file is 
+ * taken from the MEM_ALLOC_TRACE_FILE environment variable and its 
+ * capacity in events from MEM_ALLOC_TRACE_EVENTS. Setting 
+ * MEM_ALLOC_TRACE_DISABLE turns the tracer off. A forked child, which has
+ * no flusher, does not trace. An existing file is never overwritten. */
+
+#include "mem_alloc_private.h"
+
+#ifdef MEM_ALLOC_TRACE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/******************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+#define TRACE_RING_SIZE 8192
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#define TRACE_CHECKPOINTS 8
+#define TRACE_FILE_DEFAULT "mem_alloc.trace"
+#define TRACE_PATH_MAX 4096
+#define TRACE_EVENTS_DEFAULT (1LU << 24)
+#define TRACE_FILE_SIZE(events)\
+	(sizeof(mem_trace_header_t) + (events) * sizeof(mem_trace_event_t))
+/** The time the flusher sleeps between two rounds. */
+#define TRACE_PERIOD_NS 10000000LU
+/** The time spent measuring the tick rate at start up and the shortest 
+ * interval the flusher refines it over. */
+#define TRACE_CALIBRATION_NS 100000LU
+#define TRACE_RECALIBRATION_NS 1000000LU
+
+/******************************************************************************
+ * Struct definitions
+ *****************************************************************************/
+
+typedef struct trace_ring trace_ring_t;
+
+/** The events of a thread that are not yet written to the file. The 
+ * recording thread owns 'head', the flusher owns 'tail'; they are kept on
+ * separate cache lines. */
+struct trace_ring {
+	mem_trace_event_t events[TRACE_RING_SIZE];
+	alignas(64) atomic_size_t head;
+	size_t cached_tail;
+	size_t flushed;
+	size_t epoch;
+	uint32_t thread;
+	alignas(64) atomic_size_t tail;
+	atomic_bool is_exited;
+	trace_ring_t *next;
+};
+
+/******************************************************************************
+ * Global variables
+ *****************************************************************************/
+
+/** The ring of the calling thread. */
+_Thread_local static trace_ring_t *g_ring INITIAL_EXEC;
+
+/** One of the TRACE_STATE_* values, checked before any other work. */
+atomic_int g_trace_state;
+
+static pthread_once_t g_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_trace_key;
+static mem_trace_header_t *g_trace_header;
+static mem_trace_event_t *g_trace_events;
+static size_t g_trace_capacity;
+static size_t g_trace_interval;
+static atomic_size_t g_trace_epoch;
+static atomic_uint g_trace_threads;
+
+/** The rings of all threads and the flusher's wake ups, guarded by the
+ * lock. The flusher holds the lock while it drains. */
+static trace_ring_t *g_trace_rings;
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_trace_wake;
+static pthread_cond_t g_trace_drained = PTHREAD_COND_INITIALIZER;
+static pthread_t g_trace_flusher;
+static bool g_trace_stop;
+static atomic_bool g_trace_flushing;
+
+/** Owned by the flusher: the number of events written so far and the 
+ * conversion of ticks to nanoseconds, anchored at the last calibration. */
+static size_t g_trace_next;
+static uint64_t g_calibration_ticks;
+static uint64_t g_calibration_ns;
+static double g_ns_per_tick;
+
+/******************************************************************************
+ * Static helpers
+ *****************************************************************************/
+
+/** Returns the monotonic time in nanoseconds. */
+static inline uint64_t trace_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000LU + (uint64_t)ts.tv_nsec;
+}
+
+/** Returns the time stamp of a new event: the time stamp counter on x86 
+ * and the monotonic time elsewhere. */
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return trace_time();
+#endif
+}
+
+/** Converts a time stamp of an event to nanoseconds. */
+static inline uint64_t ticks_to_ns(uint64_t ticks, double ns_per_tick) {
+	int64_t delta = (int64_t)(ticks - g_calibration_ticks);
+	return g_calibration_ns + (uint64_t)(int64_t)((double)delta * ns_per_tick);
+}
+
+/** Measures the tick rate against the monotonic clock. */
+static void calibrate(void) {
+	uint64_t ticks = trace_ticks();
+	uint64_t ns = trace_time();
+	do {
+		g_calibration_ns = trace_time();
+	} while (g_calibration_ns - ns < TRACE_CALIBRATION_NS);
+	g_calibration_ticks = trace_ticks();
+	g_ns_per_tick = g_calibration_ticks != ticks ?
+		(double)(g_calibration_ns - ns) / (double)(g_calibration_ticks - ticks) :
+		1.0;
+}
+
+/** Returns the next free event of 'ring', waiting for the flusher if the
+ * ring is full.
+ * \param ring A pointer to the ring of the calling thread.
+ * \return A pointer to the event to be filled or NULL if the flusher has 
+ * stopped and the event is dropped. */
+static inline mem_trace_event_t *next_event(trace_ring_t *ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	while (head - ring->cached_tail == TRACE_RING_SIZE) {
+		ring->cached_tail =
+			atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if (head - ring->cached_tail < TRACE_RING_SIZE) break;
+		if (!atomic_load(&g_trace_flushing)) return NULL;
+		pthread_mutex_lock(&g_trace_lock);
+		pthread_cond_signal(&g_trace_wake);
+		pthread_mutex_unlock(&g_trace_lock);
+		sched_yield();
+	}
+	return &ring->events[head & TRACE_RING_MASK];
+}
+
+/** Hands the event returned by next_event() over to the flusher, waking
+ * it up each time the ring fills by half. */
+static inline void publish_event(trace_ring_t *ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+	atomic_store_explicit(&ring->head, head, memory_order_release);
+	if (!(head & (TRACE_RING_SIZE / 2 - 1)))
+		pthread_cond_signal(&g_trace_wake);
+}
+
+/** Fills an event with the values passed to it. */
+static inline void fill_event(
+	mem_trace_event_t *event, uint64_t ticks, uint32_t thread,
+	uint8_t type, uint8_t path, uint8_t flags,
+	const void *mem, const void *old_mem, const arena_t *arena,
+	size_t request, size_t block_size
+) {
+	event->time_ns = ticks;
+	event->addr = (uint64_t)(uintptr_t)mem;
+	event->old_addr = (uint64_t)(uintptr_t)old_mem;
+	event->arena = (uint64_t)(uintptr_t)arena;
+	event->request = request;
+	event->block_size = block_size;
+	event->arena_offset = arena ? arena->offset : 0;
+	event->thread = thread;
+	event->type = type;
+	event->path = path;
+	event->flags = flags;
+	event->reserved = 0;
+}
+
+/** Copies the published events of 'ring' into the trace file. Called by
+ * the flusher with the lock held.
+ * \param ring A pointer to the ring to be drained.
+ * \param ns_per_tick The tick rate of this round.
+ * \return The number of events written. */
+static size_t drain_ring(trace_ring_t *ring, double ns_per_tick) {
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	for (size_t i = tail; i != head; i++) {
+		mem_trace_event_t *event = &g_trace_events[g_trace_next % g_trace_capacity];
+		*event = ring->events[i & TRACE_RING_MASK];
+		event->time_ns = ticks_to_ns(event->time_ns, ns_per_tick);
+		if (!(++g_trace_next % g_trace_interval))
+			atomic_store_explicit(&g_trace_epoch,
+				g_trace_next / g_trace_interval, memory_order_relaxed);
+	}
+	atomic_store_explicit(&ring->tail, head, memory_order_release);
+	return head - tail;
+}
+
+/** Drains every ring and releases the rings of exited threads. Called by
+ * the flusher with the lock held. The tick rate is refined over the time
+ * since the last calibration, so the conversion stays continuous. */
+static void drain_rings(void) {
+	uint64_t ticks = trace_ticks();
+	uint64_t ns = trace_time();
+	bool is_recalibrated = ns - g_calibration_ns >= TRACE_RECALIBRATION_NS &&
+		ticks > g_calibration_ticks;
+	double ns_per_tick = is_recalibrated ?
+		(double)(ns - g_calibration_ns) / (double)(ticks - g_calibration_ticks) :
+		g_ns_per_tick;
+
+	size_t written = 0;
+	trace_ring_t **link = &g_trace_rings;
+	while (*link) {
+		trace_ring_t *ring = *link;
+		bool is_exited = atomic_load(&ring->is_exited);
+		written += drain_ring(ring, ns_per_tick);
+		if (is_exited) {
+			*link = ring->next;
+			munmap(ring, sizeof(trace_ring_t));
+		} else {
+			link = &ring->next;
+		}
+	}
+	if (is_recalibrated) {
+		g_calibration_ticks = ticks;
+		g_calibration_ns = ns;
+		g_ns_per_tick = ns_per_tick;
+	}
+	if (!written) return;
+	__atomic_store_n(&g_trace_header->count, g_trace_next, __ATOMIC_RELEASE);
+	__atomic_store_n(&g_trace_header->overwritten,
+		g_trace_next > g_trace_capacity ? g_trace_next - g_trace_capacity : 0,
+		__ATOMIC_RELEASE);
+}
+
+/** The flusher thread. It drains the rings until trace_exit() stops it 
+ * and drains them once more before it returns. */
+static void *flush_rings(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&g_trace_lock);
+	while (!g_trace_stop) {
+		drain_rings();
+		pthread_cond_broadcast(&g_trace_drained);
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_nsec += (long)TRACE_PERIOD_NS;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&g_trace_wake, &g_trace_lock, &ts);
+	}
+	drain_rings();
+	atomic_store(&g_trace_flushing, false);
+	pthread_cond_broadcast(&g_trace_drained);
+	pthread_mutex_unlock(&g_trace_lock);
+	return NULL;
+}
+
+/** Hands the ring of an exiting thread over to the flusher, which 
+ * releases it once it is drained.
+ * \param ring A pointer to the ring of the thread. */
+static void trace_thread_exit(void *ring) {
+	atomic_store(&((trace_ring_t*)ring)->is_exited, true);
+	g_ring = NULL;
+}
+
+/** Stops the flusher after it has drained every ring and writes the 
+ * trace file back. The file stays mapped and keeps its size, as other 
+ * threads may still be recording while the process exits; their events
+ * are dropped. */
+static void trace_exit(void) {
+	if (atomic_load(&g_trace_state) != TRACE_STATE_ENABLED) return;
+	pthread_mutex_lock(&g_trace_lock);
+	g_trace_stop = true;
+	pthread_cond_signal(&g_trace_wake);
+	pthread_mutex_unlock(&g_trace_lock);
+	pthread_join(g_trace_flusher, NULL);
+	atomic_store(&g_trace_state, TRACE_STATE_DISABLED);
+	msync(g_trace_header, TRACE_FILE_SIZE(g_trace_capacity), MS_SYNC);
+}
+
+/** Turns the tracer off in a forked child, which has no flusher. */
+static void trace_fork_child(void) {
+	atomic_store(&g_trace_state, TRACE_STATE_DISABLED);
+	atomic_store(&g_trace_flushing, false);
+	g_ring = NULL;
+}
+
+/** Creates the trace file at 'path' or, if a file already exists there,
+ * at 'path' suffixed with the process id.
+ * \param path The requested path of the trace file.
+ * \return A file descriptor of the new file or -1 on failure. */
+static int create_trace_file(const char *path) {
+	int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd >= 0 || errno != EEXIST) return fd;
+
+	char fallback[TRACE_PATH_MAX];
+	int len = snprintf(
+		fallback, sizeof(fallback), "%s.%ld", path, (long)getpid());
+	if (len < 0 || (size_t)len >= sizeof(fallback)) return -1;
+	fd = open(fallback, O_RDWR | O_CREAT | O_EXCL, 0644);
+	fprintf(stderr, "[MEM_ALLOC WARNING]:\n");
+	if (fd >= 0)
+		fprintf(stderr, "\t%s exists, tracing to %s\n", path, fallback);
+	else
+		fprintf(stderr, "\t%s exists, tracing disabled\n", path);
+	return fd;
+}
+
+/** Maps the trace file and starts the flusher.
+ * \return 0 on success, -1 on failure. */
+static int start_tracing(void) {
+	if (getenv("MEM_ALLOC_TRACE_DISABLE")) return -1;
+	const char *path = getenv("MEM_ALLOC_TRACE_FILE");
+	if (!path) path = TRACE_FILE_DEFAULT;
+	const char *events = getenv("MEM_ALLOC_TRACE_EVENTS");
+	g_trace_capacity = events ? strtoul(events, NULL, 10) : 0;
+	if (!g_trace_capacity) g_trace_capacity = TRACE_EVENTS_DEFAULT;
+	if (g_trace_capacity < TRACE_RING_SIZE) g_trace_capacity = TRACE_RING_SIZE;
+	g_trace_interval = g_trace_capacity / TRACE_CHECKPOINTS;
+
+	int fd = create_trace_file(path);
+	if (fd < 0) return -1;
+	if (ftruncate(fd, (off_t)TRACE_FILE_SIZE(g_trace_capacity))) {
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(
+		NULL,
+		TRACE_FILE_SIZE(g_trace_capacity),
+		PROT_WRITE | PROT_READ,
+		MAP_SHARED,
+		fd, 0
+	);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&g_trace_wake, &attr);
+	pthread_condattr_destroy(&attr);
+	g_trace_header = (mem_trace_header_t*)map;
+	g_trace_events = (mem_trace_event_t*)(g_trace_header + 1);
+	calibrate();
+	atomic_store(&g_trace_flushing, true);
+	if (pthread_key_create(&g_trace_key, trace_thread_exit) ||
+		pthread_create(&g_trace_flusher, NULL, flush_rings, NULL)) {
+		atomic_store(&g_trace_flushing, false);
+		munmap(map, TRACE_FILE_SIZE(g_trace_capacity));
+		return -1;
+	}
+
+	memcpy(g_trace_header->magic, MEM_TRACE_MAGIC, sizeof(g_trace_header->magic));
+	g_trace_header->version = MEM_TRACE_VERSION;
+	g_trace_header->event_size = sizeof(mem_trace_event_t);
+	g_trace_header->arena_size = ARENA_SIZE;
+	g_trace_header->mem_offset = MEM_OFFSET;
+	g_trace_header->min_alloc = MIN_ALLOC;
+	g_trace_header->capacity = g_trace_capacity;
+	atexit(trace_exit);
+	pthread_atfork(NULL, NULL, trace_fork_child);
+	return 0;
+}
+
+/** Starts the tracer and publishes whether it is enabled. */
+static void trace_init(void) {
+	atomic_store(&g_trace_state,
+		start_tracing() ? TRACE_STATE_DISABLED : TRACE_STATE_ENABLED);
+}
+
+/** Returns the ring of the calling thread, creating it on first use.
+ * \return A pointer to the ring or NULL if tracing is unavailable. */
+static inline trace_ring_t *get_ring(void) {
+	if (g_ring) return g_ring;
+	pthread_once(&g_trace_once, trace_init);
+	if (atomic_load(&g_trace_state) != TRACE_STATE_ENABLED) return NULL;
+
+	trace_ring_t *ring = (trace_ring_t*)mmap(
+		NULL,
+		sizeof(trace_ring_t),
+		PROT_WRITE | PROT_READ,
+		MAP_ANONYMOUS | MAP_PRIVATE,
+		-1, 0
+	);
+	if (ring == MAP_FAILED) return NULL;
+	ring->thread = atomic_fetch_add(&g_trace_threads, 1);
+	ring->epoch = atomic_load_explicit(&g_trace_epoch, memory_order_relaxed);
+	pthread_setspecific(g_trace_key, ring);
+	pthread_mutex_lock(&g_trace_lock);
+	ring->next = g_trace_rings;
+	g_trace_rings = ring;
+	pthread_mutex_unlock(&g_trace_lock);
+	g_ring = ring;
+	return ring;
+}
+
+/** Records the occupancy of 'arena' into 'ring'.
+ * \param ring A pointer to the ring of the calling thread.
+ * \param arena A pointer to the arena owned by the calling thread. */
+static void record_checkpoint(trace_ring_t *ring, const arena_t *arena) {
+	uint64_t ticks = trace_ticks();
+	mem_trace_event_t *event = next_event(ring);
+	if (!event) return;
+	fill_event(event, ticks, ring->thread,
+		MEM_TRACE_CHECKPOINT, MEM_TRACE_PATH_TAIL, 0,
+		arena, NULL, arena, 0, 0);
+	publish_event(ring);
+	for (const ptr_t *ptr = arena->ptrs_tail; ptr; ptr = ptr->prev) {
+		if (!(event = next_event(ring))) return;
+		fill_event(event, ticks, ring->thread,
+			MEM_TRACE_CHECKPOINT,
+			ptr->is_valid ? MEM_TRACE_PATH_BUMP : MEM_TRACE_PATH_FREE_LIST, 0,
+			ptr->mem, NULL, arena, 0, ptr->total_size - MEM_OFFSET);
+		publish_event(ring);
+	}
+
+	const unsigned char *buff = arena->buff;
+	for (size_t cls = 0; cls <= MEM_ALLOC_TCACHE_CLASSES; cls++) {
+		for (void *mem = g_mem_alloc_tcache.heads[cls]; mem; mem = *(void**)mem) {
+			const unsigned char *cached = (const unsigned char*)mem;
+			if (cached < buff || cached >= buff + ARENA_SIZE) continue;
+			if (!(event = next_event(ring))) return;
+			fill_event(event, ticks, ring->thread,
+				MEM_TRACE_CHECKPOINT, MEM_TRACE_PATH_TCACHE, 0,
+				mem, NULL, arena, 0, PTR(mem)->total_size - MEM_OFFSET);
+			publish_event(ring);
+		}
+	}
+}
+
+/******************************************************************************
+ * Helpers for the test utility
+ *****************************************************************************/
+
+/** For the test utility: Copies the last events recorded by the calling
+ * thread, oldest first. The events stay in the ring after they are 
+ * written to the file, until the thread records over them, and their 
+ * time is not yet converted to nanoseconds.
+ * \param events A pointer to an array of at least 'count' events.
+ * \param count The number of events to copy.
+ * \return The number of events copied. */
+size_t trace_buffer(mem_trace_event_t *events, size_t count) {
+	trace_ring_t *ring = get_ring();
+	if (!ring) return 0;
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (count > head) count = head;
+	if (count > TRACE_RING_SIZE) count = TRACE_RING_SIZE;
+	for (size_t i = 0; i < count; i++)
+		events[i] = ring->events[(head - count + i) & TRACE_RING_MASK];
+	return count;
+}
+
+/** For the test utility: Records a checkpoint of 'arena' into the ring
+ * of the calling thread.
+ * \param arena A pointer to the arena owned by the calling thread. */
+void trace_checkpoint(const arena_t *arena) {
+	trace_ring_t *ring = get_ring();
+	if (ring) record_checkpoint(ring, arena);
+}
+
+/******************************************************************************
+ * Tracer functions used by the library
+ *****************************************************************************/
+
+/** Records an event in the calling thread's ring. The first event of a
+ * thread's arena after the log has advanced by a checkpoint interval is
+ * followed by a checkpoint of the arena. Callers check g_trace_state 
+ * first, so a disabled tracer costs a single load.
+ * \param type The operation, one of mem_trace_type_t.
+ * \param path The path taken, one of mem_trace_path_t.
+ * \param flags A combination of mem_trace_flag_t.
+ * \param mem The address returned to or passed by the caller.
+ * \param old_mem The address passed to mem_realloc() or NULL.
+ * \param arena A pointer to the arena that served the event or NULL.
+ * \param request The size passed by the caller.
+ * \param block_size The usable size of the block after the event. */
+void trace_event(
+	uint8_t type, uint8_t path, uint8_t flags,
+	const void *mem, const void *old_mem, const arena_t *arena,
+	size_t request, size_t block_size
+) {
+	if (!mem) return;
+	trace_ring_t *ring = get_ring();
+	if (!ring) return;
+
+	mem_trace_event_t *event = next_event(ring);
+	if (!event) return;
+	fill_event(event, trace_ticks(), ring->thread,
+		type, path, flags, mem, old_mem, arena, request, block_size);
+	publish_event(ring);
+
+	size_t epoch = atomic_load_explicit(&g_trace_epoch, memory_order_relaxed);
+	if (ring->epoch != epoch && arena &&
+		!(flags & MEM_TRACE_FLAG_EXPLICIT_ARENA)) {
+		ring->epoch = epoch;
+		record_checkpoint(ring, arena);
+	}
+}
+
+#endif
+
+/******************************************************************************
+ * Public function definitions
+ *****************************************************************************/
+
+/** Waits until the events recorded by the calling thread have been 
+ * written to the trace file. Events are otherwise written by a background
+ * thread as they are recorded, and once more when the process exits.
+ * \return The number of events the calling thread recorded since its 
+ * previous call or -1 if the library was built without MEM_ALLOC_TRACE or
+ * the trace file could not be created. */
+int mem_trace_flush(void) {
+#ifdef MEM_ALLOC_TRACE
+	trace_ring_t *ring = get_ring();
+	if (!ring) return -1;
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	pthread_mutex_lock(&g_trace_lock);
+	while (atomic_load(&ring->tail) != head && atomic_load(&g_trace_flushing)) {
+		pthread_cond_signal(&g_trace_wake);
+		pthread_cond_wait(&g_trace_drained, &g_trace_lock);
+	}
+	pthread_mutex_unlock(&g_trace_lock);
+	size_t written = head - ring->flushed;
+	ring->flushed = head;
+	return (int)written;
+#else
+	return -1;
+#endif
+}
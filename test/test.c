@@ -1,5 +1,6 @@
 #include <test.h>
 #include "mem_alloc_private.h"
+#include <pthread.h>
 
 TEST_INIT;
 
@@ -213,6 +214,369 @@ void test_mem_realloc() {
 	ASSERT(*new_intptr == 5);
 }
 
+void test_tcache_push_pop() {
+	mem_alloc_tcache_t tcache = {0};
+	unsigned char buff[2][MIN_ALLOC * 2] = {0};
+	ASSERT(!tcache_pop(MIN_ALLOC, &tcache));
+
+	// A cache without an exit hook takes no blocks
+	ASSERT(!tcache_push(buff[0], MIN_ALLOC, &tcache));
+	tcache.limit = TCACHE_LIMIT;
+
+	ASSERT(tcache_push(buff[0], MIN_ALLOC, &tcache));
+	ASSERT(tcache_push(buff[1], MIN_ALLOC - 1, &tcache));
+	ASSERT(tcache.size == 2 * MEM_ALLOC_TCACHE_COST(1));
+	ASSERT(!tcache_pop(MIN_ALLOC * 2, &tcache));
+	ASSERT(tcache_pop(1, &tcache) == buff[1]);
+	ASSERT(tcache_pop(MIN_ALLOC, &tcache) == buff[0]);
+	ASSERT(!tcache_pop(MIN_ALLOC, &tcache));
+
+	ASSERT(!tcache.size);
+
+	// Sizes not served by the cache
+	ASSERT(!tcache_push(buff[0], 0, &tcache));
+	ASSERT(!tcache_push(
+		buff[0], MIN_ALLOC * MEM_ALLOC_TCACHE_CLASSES + 1, &tcache));
+	ASSERT(!tcache_push(buff[0], SIZE_MAX - 8, &tcache));
+	ASSERT(!tcache_pop(SIZE_MAX - 8, &tcache));
+	ASSERT(MEM_ALLOC_TCACHE_FITS(MIN_ALLOC * MEM_ALLOC_TCACHE_CLASSES));
+
+	// Full cache
+	tcache.size = TCACHE_LIMIT - MEM_ALLOC_TCACHE_COST(1) + 1;
+	ASSERT(!tcache_push(buff[0], MIN_ALLOC, &tcache));
+}
+
+void test_mem_free_sized() {
+	reset_global_arena();
+	arena_t *arena = global_arena();
+
+	// add to the thread's cache
+	void *mem = mem_alloc(sizeof(int));
+	ASSERT(mem_free_sized(mem, sizeof(int)) == 3);
+	ASSERT(PTR(mem)->is_valid);
+	ASSERT(arena->ptrs_tail == PTR(mem));
+	void *mem2 = mem_alloc(sizeof(int));
+	ASSERT(mem2 == mem);
+	ASSERT(mem_free(mem2) == 1);
+	ASSERT(!arena->offset);
+
+	// a full tail releases the cache before anything else
+	mem = mem_alloc(sizeof(int));
+	void *tail = mem_alloc(ARENA_SIZE - arena->offset - MEM_OFFSET);
+	ASSERT(mem_free_sized(mem, sizeof(int)) == 3);
+	ASSERT(PTR(mem)->is_valid);
+	ASSERT(mem_free(tail) == 1);
+	tail = mem_alloc(ARENA_SIZE - MEM_OFFSET);
+	ASSERT(tail == mem);
+	ASSERT(!PTR(tail)->is_mmap);
+	ASSERT(!g_mem_alloc_tcache.size);
+	ASSERT(mem_free(tail) == 1);
+	ASSERT(!arena->offset);
+
+	// fall through to mem_free
+	mem = mem_alloc(ARENA_SIZE / 32);
+	ASSERT(mem_free_sized(mem, ARENA_SIZE / 32) == 1);
+	ASSERT(mem_free_sized(NULL, sizeof(int)) == -1);
+}
+
+void test_mem_free_merge_and_reuse() {
+	reset_global_arena();
+	arena_t *arena = global_arena();
+	const size_t SIZE = ARENA_SIZE / 32;
+
+	void *mem = mem_alloc(SIZE);
+	void *mem2 = mem_alloc(SIZE);
+	void *mem3 = mem_alloc(SIZE);
+	void *mem4 = mem_alloc(SIZE);
+
+	// Reuse from the free list
+	ASSERT(mem_free(mem2) == 2);
+	void *mem5 = mem_alloc(SIZE);
+	ASSERT(mem5 == mem2);
+	ASSERT(PTR(mem5)->is_valid);
+	ASSERT(!arena->free_ptr_tails[SIZE_CLASS(SIZE)]);
+
+	// Merge with the previous and the next pointer
+	ASSERT(mem_free(mem) == 2);
+	ASSERT(mem_free(mem3) == 2);
+	ASSERT(mem_free(mem5) == 2);
+	size_t merged_total_size = PTR(mem4)->total_size * 3;
+	ptr_t **merged_tail = 
+		&arena->free_ptr_tails[SIZE_CLASS(merged_total_size - MEM_OFFSET)];
+	ASSERT(PTR(mem)->next == PTR(mem4));
+	ASSERT(PTR(mem4)->prev == PTR(mem));
+	ASSERT(PTR(mem)->total_size == merged_total_size);
+	ASSERT(*merged_tail == PTR(mem));
+
+	// Freeing the tail also releases the free pointer before it
+	ASSERT(mem_free(mem4) == 1);
+	ASSERT(!arena->offset);
+	ASSERT(!arena->ptrs_tail);
+	ASSERT(!*merged_tail);
+}
+
+void test_mem_alloc_split() {
+	reset_global_arena();
+	arena_t *arena = global_arena();
+	const size_t SIZE = ARENA_SIZE / 4;
+	void *mem = mem_alloc(SIZE);
+	void *mem2 = mem_alloc(SIZE);
+	void *mem3 = mem_alloc(SIZE);
+	ASSERT(mem_free(mem) == 2);
+	ASSERT(mem_free(mem2) == 2);
+
+	// The tail is full, so the merged pointer is split
+	ASSERT(mem_alloc(SIZE) == mem);
+	ASSERT(PTR(mem)->total_size == MEM_OFFSET + SIZE);
+	ASSERT(PTR(mem)->next == PTR(mem2));
+	ASSERT(!PTR(mem2)->is_valid);
+	ASSERT(arena->free_ptr_tails[SIZE_CLASS(SIZE)] == PTR(mem2));
+
+	// The rest is reused by its exact class
+	ASSERT(mem_alloc(SIZE) == mem2);
+	ASSERT(!arena->free_ptr_tails[SIZE_CLASS(SIZE)]);
+	ASSERT(!find_free_ptr(0, arena));
+
+	ASSERT(mem_free(mem3) == 1);
+	ASSERT(mem_free(mem2) == 1);
+	ASSERT(mem_free(mem) == 1);
+	ASSERT(!arena->offset);
+}
+
+void test_mem_realloc_releases_old() {
+	reset_global_arena();
+	arena_t *arena = global_arena();
+	const size_t SIZE = ARENA_SIZE / 32;
+
+	// The moved block is released to the free list
+	void *mem = mem_alloc(SIZE);
+	void *mem2 = mem_alloc(SIZE);
+	void *new_mem = mem_realloc(mem, SIZE * 2);
+	ASSERT(new_mem != mem);
+	ASSERT(!PTR(mem)->is_valid);
+	ASSERT(arena->free_ptr_tails[SIZE_CLASS(ROUNDUP(SIZE, MIN_ALLOC))] == PTR(mem));
+	ASSERT(mem_alloc(SIZE) == mem);
+
+	// Freeing the tail block also releases the free blocks before it
+	ASSERT(mem_free(mem) == 2);
+	ASSERT(mem_free(mem2) == 2);
+	ASSERT(mem_free(new_mem) == 1);
+	ASSERT(!arena->offset);
+}
+
+void test_mem_try_alloc() {
+	reset_global_arena();
+	void *mem = mem_try_alloc(ARENA_SIZE / 2);
+	ASSERT(mem);
+	ASSERT(mem_owns(mem));
+	ASSERT(!mem_try_alloc(ARENA_SIZE / 2));
+	ASSERT(mem_free(mem) == 1);
+
+	void *heap = mem_alloc(ARENA_SIZE * 2);
+	ASSERT(!mem_owns(heap));
+	ASSERT(!mem_free(heap));
+}
+
+void test_mem_alloc_overflow() {
+	reset_global_arena();
+	// Sizes close to SIZE_MAX must not wrap into small blocks
+	ASSERT(!mem_alloc(SIZE_MAX - 8));
+	ASSERT(!mem_try_alloc(SIZE_MAX - 8));
+	ASSERT(!global_arena()->offset);
+
+	void *mem = mem_alloc(MIN_ALLOC);
+	ASSERT(!mem_realloc(mem, SIZE_MAX - 8));
+	ASSERT(PTR(mem)->is_valid);
+	ASSERT(mem_free(mem) == 1);
+
+	mem_arena_t *arena = mem_arena_new();
+	ASSERT(!mem_arena_alloc(arena, SIZE_MAX - 8));
+	ASSERT(!mem_arena_delete(arena));
+}
+
+void test_mem_arena() {
+	mem_arena_t *arena = mem_arena_new();
+	ASSERT(arena);
+	const size_t SIZE = ARENA_SIZE / 32;
+
+	void *mem = mem_arena_alloc(arena, SIZE);
+	void *mem2 = mem_arena_alloc(arena, SIZE);
+	ASSERT(mem && mem2);
+	ASSERT(!mem_owns(mem));
+	ASSERT(arena->ptrs_tail == PTR(mem2));
+	ASSERT(mem_arena_free(arena, mem) == 2);
+	ASSERT(mem_arena_free(arena, mem2) == 1);
+	ASSERT(!arena->offset);
+
+	void *heap = mem_arena_alloc(arena, ARENA_SIZE * 2);
+	ASSERT(PTR(heap)->is_mmap);
+	ASSERT(!mem_arena_free(arena, heap));
+
+	ASSERT(!mem_arena_alloc(NULL, SIZE));
+	ASSERT(mem_arena_free(NULL, mem) == -1);
+	ASSERT(!mem_arena_delete(arena));
+	ASSERT(mem_arena_delete(NULL) == -1);
+}
+
+#ifdef MEM_ALLOC_TRACE
+void test_trace_events() {
+	reset_global_arena();
+	arena_t *arena = global_arena();
+	const size_t SIZE = ARENA_SIZE / 32;
+	size_t total_size = MEM_OFFSET + ROUNDUP(SIZE, MIN_ALLOC);
+	ASSERT(mem_trace_flush() >= 0);
+
+	void *mem = mem_alloc(SIZE);
+	void *mem2 = mem_alloc(SIZE);
+	ASSERT(mem_free(mem) == 2);
+	void *mem3 = mem_realloc(mem2, SIZE * 2);
+	ASSERT(mem_free(mem3) == 1);
+
+	mem_trace_event_t events[7];
+	ASSERT(trace_buffer(events, 7) == 7);
+	ASSERT(events[0].type == MEM_TRACE_ALLOC);
+	ASSERT(events[0].path == MEM_TRACE_PATH_BUMP);
+	ASSERT(events[0].addr == (uint64_t)(uintptr_t)mem);
+	ASSERT(events[0].arena == (uint64_t)(uintptr_t)arena);
+	ASSERT(events[0].request == SIZE);
+	ASSERT(events[1].arena_offset == total_size * 2);
+	ASSERT(events[2].type == MEM_TRACE_FREE);
+	ASSERT(events[2].path == MEM_TRACE_PATH_FREE_LIST);
+	ASSERT(events[3].path == MEM_TRACE_PATH_BUMP);
+	ASSERT(events[3].flags == MEM_TRACE_FLAG_NESTED);
+	ASSERT(events[4].path == MEM_TRACE_PATH_COALESCE);
+	ASSERT(events[4].flags == MEM_TRACE_FLAG_NESTED);
+	ASSERT(events[5].type == MEM_TRACE_REALLOC);
+	ASSERT(events[5].path == MEM_TRACE_PATH_MOVE);
+	ASSERT(events[5].old_addr == (uint64_t)(uintptr_t)mem2);
+	ASSERT(events[5].addr == (uint64_t)(uintptr_t)mem3);
+	ASSERT(!events[5].flags);
+	ASSERT(events[6].path == MEM_TRACE_PATH_TAIL);
+	ASSERT(!events[6].arena_offset);
+	ASSERT(mem_trace_flush() == 7);
+}
+
+void test_trace_checkpoint() {
+	reset_global_arena();
+	arena_t *arena = global_arena();
+	const size_t SIZE = ARENA_SIZE / 32;
+	ASSERT(mem_trace_flush() >= 0);
+
+	void *mem = mem_alloc(SIZE);
+	void *mem2 = mem_alloc(SIZE);
+	void *mem3 = mem_alloc(MIN_ALLOC);
+	ASSERT(mem_free(mem) == 2);
+	ASSERT(mem_free_sized(mem3, MIN_ALLOC) == 3);
+	ASSERT(mem_trace_flush() == 5);
+
+	trace_checkpoint(arena);
+	mem_trace_event_t events[5];
+	ASSERT(trace_buffer(events, 5) == 5);
+	for (size_t i = 0; i < 5; i++)
+		ASSERT(events[i].type == MEM_TRACE_CHECKPOINT);
+	ASSERT(events[0].path == MEM_TRACE_PATH_TAIL);
+	ASSERT(events[0].arena_offset == arena->offset);
+	ASSERT(events[1].path == MEM_TRACE_PATH_BUMP);
+	ASSERT(events[1].addr == (uint64_t)(uintptr_t)mem3);
+	ASSERT(events[2].path == MEM_TRACE_PATH_BUMP);
+	ASSERT(events[2].addr == (uint64_t)(uintptr_t)mem2);
+	ASSERT(events[3].path == MEM_TRACE_PATH_FREE_LIST);
+	ASSERT(events[3].addr == (uint64_t)(uintptr_t)mem);
+	ASSERT(events[3].block_size == ROUNDUP(SIZE, MIN_ALLOC));
+	ASSERT(events[4].path == MEM_TRACE_PATH_TCACHE);
+	ASSERT(events[4].addr == (uint64_t)(uintptr_t)mem3);
+	ASSERT(mem_trace_flush() == 5);
+	reset_global_arena();
+}
+#endif
+
+static void *alloc_on_thread(void *arg) {
+	(void)arg;
+	return mem_alloc(64);
+}
+
+void test_mem_free_remote() {
+	reset_global_arena();
+	pthread_t thread;
+	void *mem = NULL;
+	void *mem2 = NULL;
+
+	// Memory of an exited thread is handed back to its arena
+	ASSERT(!pthread_create(&thread, NULL, alloc_on_thread, NULL));
+	ASSERT(!pthread_join(thread, &mem));
+	ASSERT(mem_owns(mem));
+	ASSERT(PTR(mem)->arena != global_arena());
+	ASSERT(mem_free(mem) == 4);
+	ASSERT(!global_arena()->offset);
+
+	// The next thread adopts the arena and releases the memory
+	ASSERT(!pthread_create(&thread, NULL, alloc_on_thread, NULL));
+	ASSERT(!pthread_join(thread, &mem2));
+	ASSERT(mem2 == mem);
+	ASSERT(mem_free(mem2) == 4);
+
+	// Memory of the calling thread is freed locally
+	mem = mem_alloc(64);
+	ASSERT(PTR(mem)->arena == global_arena());
+	ASSERT(mem_free(mem) == 1);
+}
+
+enum { NUM_HANDED_OVER = 32 };
+static void *free_sized_on_thread(void *arg) {
+	void **mems = arg;
+	for (size_t i = 0; i < NUM_HANDED_OVER; i++)
+		mem_free_sized(mems[i], 64);
+	return NULL;
+}
+
+void test_mem_free_sized_remote() {
+	reset_global_arena();
+	void *mems[NUM_HANDED_OVER];
+	size_t offset = 0;
+
+	// A thread that only frees releases its cache when it exits
+	for (size_t round = 0; round < 3; round++) {
+		for (size_t i = 0; i < NUM_HANDED_OVER; i++)
+			mems[i] = mem_alloc(64);
+		if (!round)
+			offset = global_arena()->offset;
+		ASSERT(global_arena()->offset == offset);
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, free_sized_on_thread, mems));
+		ASSERT(!pthread_join(thread, NULL));
+	}
+	mem_alloc(64);
+	ASSERT(global_arena()->offset == MEM_OFFSET + 64);
+	reset_global_arena();
+}
+
+static pthread_barrier_t g_barrier;
+static void *alloc_on_live_thread(void *arg) {
+	(void)arg;
+	void *mem = mem_alloc(64);
+	pthread_barrier_wait(&g_barrier);
+	return mem;
+}
+
+void test_arena_regions() {
+	// Live threads beyond one region get arenas from the next region
+	enum { NUM_THREADS = ARENAS_PER_REGION + 8 };
+	pthread_t threads[NUM_THREADS];
+	void *mems[NUM_THREADS];
+	ASSERT(!pthread_barrier_init(&g_barrier, NULL, NUM_THREADS));
+	for (size_t i = 0; i < NUM_THREADS; i++)
+		ASSERT(!pthread_create(&threads[i], NULL, alloc_on_live_thread, NULL));
+	bool is_owned = true;
+	for (size_t i = 0; i < NUM_THREADS; i++) {
+		ASSERT(!pthread_join(threads[i], &mems[i]));
+		is_owned = is_owned && mem_owns(mems[i]) && !PTR(mems[i])->is_mmap;
+	}
+	ASSERT(is_owned);
+	for (size_t i = 0; i < NUM_THREADS; i++)
+		ASSERT(mem_free(mems[i]) == 4);
+	pthread_barrier_destroy(&g_barrier);
+}
+
 int main(void) {
 	test_use_mmap();
 	test_use_arena();
@@ -223,6 +587,21 @@ int main(void) {
 	test_mem_free();
 	test_alloc_struct_member();
 	test_mem_realloc();
+	test_tcache_push_pop();
+	test_mem_free_sized();
+	test_mem_free_merge_and_reuse();
+	test_mem_alloc_split();
+	test_mem_realloc_releases_old();
+	test_mem_try_alloc();
+	test_mem_alloc_overflow();
+	test_mem_arena();
+	test_mem_free_remote();
+	test_mem_free_sized_remote();
+	test_arena_regions();
+#ifdef MEM_ALLOC_TRACE
+	test_trace_events();
+	test_trace_checkpoint();
+#endif
 	
 	test_print_results();
 	return 0;
@@ -0,0 +1,218 @@
+#include <test.h>
+#define MEM_ALLOC_REPLACE_NEW
+#include "mem_alloc.hpp"
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+TEST_INIT;
+
+static const std::size_t HUGE_SIZE = SIZE_MAX / 4;
+static const std::size_t WRAPPING_SIZE = SIZE_MAX - 8;
+static const std::size_t LARGE_SIZE = 1 << 20;
+
+struct alignas(64) over_aligned {
+	unsigned char data[64];
+};
+
+static bool is_aligned(const void *ptr, std::size_t alignment) {
+	return !(reinterpret_cast<std::uintptr_t>(ptr) & (alignment - 1));
+}
+
+void test_thread_resource() {
+	mem::thread_resource *resource = mem::thread_arena_resource();
+	void *mem = resource->allocate(64, alignof(std::max_align_t));
+	ASSERT(mem_owns(mem));
+	resource->deallocate(mem, 64, alignof(std::max_align_t));
+
+	// The sized deallocation goes through the thread's cache
+	void *cached = resource->allocate(64, alignof(std::max_align_t));
+	ASSERT(cached == mem);
+	resource->deallocate(cached, 64, alignof(std::max_align_t));
+
+	// Over-aligned requests are forwarded to new_delete_resource()
+	void *aligned = resource->allocate(64, 64);
+	ASSERT(is_aligned(aligned, 64));
+	ASSERT(!mem_owns(aligned));
+	resource->deallocate(aligned, 64, 64);
+
+	for (std::size_t size : {HUGE_SIZE, WRAPPING_SIZE}) {
+		bool thrown = false;
+		try {
+			ASSERT(!resource->allocate(size, alignof(std::max_align_t)));
+		} catch (const std::bad_alloc&) {
+			thrown = true;
+		}
+		ASSERT(thrown);
+	}
+
+	mem::thread_resource other;
+	ASSERT(resource->is_equal(other));
+	ASSERT(!resource->is_equal(*std::pmr::new_delete_resource()));
+}
+
+void test_arena_resource() {
+	mem::arena_resource resource;
+	const unsigned char *arena =
+		reinterpret_cast<const unsigned char*>(resource.get());
+	unsigned char *mem = static_cast<unsigned char*>(
+		resource.allocate(64, alignof(std::max_align_t)));
+	ASSERT(mem >= arena && mem < arena + LARGE_SIZE);
+	ASSERT(!mem_owns(mem));
+
+	// Requests that do not fit in the arena overflow to mmap
+	unsigned char *large = static_cast<unsigned char*>(
+		resource.allocate(LARGE_SIZE, alignof(std::max_align_t)));
+	ASSERT(large < arena || large >= arena + LARGE_SIZE);
+	large[0] = 1;
+	large[LARGE_SIZE - 1] = 1;
+	resource.deallocate(large, LARGE_SIZE, alignof(std::max_align_t));
+	resource.deallocate(mem, 64, alignof(std::max_align_t));
+
+	void *aligned = resource.allocate(64, 64);
+	ASSERT(is_aligned(aligned, 64));
+	resource.deallocate(aligned, 64, 64);
+
+	for (std::size_t size : {HUGE_SIZE, WRAPPING_SIZE}) {
+		bool thrown = false;
+		try {
+			ASSERT(!resource.allocate(size, alignof(std::max_align_t)));
+		} catch (const std::bad_alloc&) {
+			thrown = true;
+		}
+		ASSERT(thrown);
+	}
+
+	mem::arena_resource other;
+	ASSERT(resource.is_equal(resource));
+	ASSERT(!resource.is_equal(other));
+}
+
+void test_allocator() {
+	std::vector<int, mem::allocator<int>> vector(100, 1);
+	ASSERT(mem_owns(vector.data()));
+
+	int *one = mem::allocator<int>().allocate(1);
+	mem::allocator<int>().deallocate(one, 1);
+	ASSERT(mem::allocator<int>().allocate(1) == one);
+	mem::allocator<int>().deallocate(one, 1);
+	ASSERT(mem::allocator<int>() == mem::allocator<char>());
+
+	bool thrown = false;
+	try {
+		ASSERT(!mem::allocator<int>().allocate(SIZE_MAX / 2));
+	} catch (const std::bad_array_new_length&) {
+		thrown = true;
+	}
+	ASSERT(thrown);
+
+	for (std::size_t size : {HUGE_SIZE, WRAPPING_SIZE}) {
+		thrown = false;
+		try {
+			ASSERT(!mem::allocator<char>().allocate(size));
+		} catch (const std::bad_alloc&) {
+			thrown = true;
+		}
+		ASSERT(thrown);
+	}
+}
+
+void test_replaced_new() {
+	int *small = new int(1);
+	ASSERT(mem_owns(small));
+	delete small;
+	int *cached = new int(2);
+	ASSERT(cached == small);
+	delete cached;
+
+	char *large = new char[LARGE_SIZE];
+	ASSERT(!mem_owns(large));
+	delete[] large;
+
+	over_aligned *aligned = new over_aligned;
+	ASSERT(is_aligned(aligned, 64));
+	ASSERT(!mem_owns(aligned));
+	delete aligned;
+
+	ASSERT(!new (std::nothrow) char[HUGE_SIZE]);
+	for (std::size_t size : {HUGE_SIZE, WRAPPING_SIZE}) {
+		bool thrown = false;
+		try {
+			::operator delete(::operator new(size));
+		} catch (const std::bad_alloc&) {
+			thrown = true;
+		}
+		ASSERT(thrown);
+
+		thrown = false;
+		try {
+			::operator delete(::operator new(size, std::align_val_t(64)));
+		} catch (const std::bad_alloc&) {
+			thrown = true;
+		}
+		ASSERT(thrown);
+	}
+}
+
+void test_threads() {
+	// The thread state is allocated here and freed by the new thread
+	std::thread([] {}).join();
+
+	int *outer = new int(1);
+	std::thread([outer] { delete outer; }).join();
+
+	int *inner = nullptr;
+	std::thread([&inner] { inner = new int(2); }).join();
+	ASSERT(mem_owns(inner));
+	ASSERT(*inner == 2);
+	delete inner;
+
+	std::pmr::vector<int> *pmr_vector = nullptr;
+	std::thread([&pmr_vector] {
+		pmr_vector = new std::pmr::vector<int>(mem::thread_arena_resource());
+		for (int i = 0; i < 1000; i++)
+			pmr_vector->push_back(i);
+	}).join();
+	ASSERT(mem_owns(pmr_vector->data()));
+	ASSERT((*pmr_vector)[999] == 999);
+	delete pmr_vector;
+
+	std::vector<int, mem::allocator<int>> vector;
+	std::thread([&vector] {
+		std::vector<int, mem::allocator<int>> filled(1000, 3);
+		vector = std::move(filled);
+	}).join();
+	ASSERT(vector.size() == 1000 && vector[999] == 3);
+	vector = {};
+
+	std::vector<int*> ptrs(8000);
+	for (std::size_t i = 0; i < ptrs.size(); i++)
+		ptrs[i] = new int(static_cast<int>(i));
+	std::vector<std::thread> threads;
+	for (std::size_t t = 0; t < 8; t++)
+		threads.emplace_back([&ptrs, t] {
+			for (std::size_t i = t; i < ptrs.size(); i += 8) {
+				delete ptrs[i];
+				ptrs[i] = new int(static_cast<int>(i));
+			}
+		});
+	for (std::thread &thread : threads)
+		thread.join();
+	bool is_intact = true;
+	for (std::size_t i = 0; i < ptrs.size(); i++) {
+		is_intact = is_intact && *ptrs[i] == static_cast<int>(i);
+		delete ptrs[i];
+	}
+	ASSERT(is_intact);
+}
+
+int main(void) {
+	test_thread_resource();
+	test_arena_resource();
+	test_allocator();
+	test_replaced_new();
+	test_threads();
+
+	test_print_results();
+	return 0;
+}
@@ -0,0 +1,98 @@
+#define MEM_ALLOC_INLINE
+#include <test.h>
+#include "mem_alloc_private.h"
+#include <pthread.h>
+
+TEST_INIT;
+
+void test_inline_hit() {
+	reset_global_arena();
+	size_t cls = MEM_ALLOC_TCACHE_CLASS(MIN_ALLOC);
+	void *mem = mem_alloc(MIN_ALLOC);
+	size_t offset = global_arena()->offset;
+	ASSERT(mem_free_sized(mem, MIN_ALLOC) == 3);
+	ASSERT(g_mem_alloc_tcache.heads[cls] == mem);
+	ASSERT(g_mem_alloc_tcache.size == MEM_ALLOC_TCACHE_COST(cls));
+
+	ASSERT(mem_alloc(MIN_ALLOC) == mem);
+	ASSERT(!g_mem_alloc_tcache.heads[cls]);
+	ASSERT(!g_mem_alloc_tcache.size);
+	ASSERT(global_arena()->offset == offset);
+	ASSERT(PTR(mem)->is_valid);
+}
+
+void test_inline_miss() {
+	reset_global_arena();
+	void *mem = mem_alloc(MIN_ALLOC);
+	ASSERT(mem_free_sized(mem, MIN_ALLOC) == 3);
+
+	// A different size class falls through to the library
+	void *mem2 = mem_alloc(MIN_ALLOC * 2);
+	ASSERT(mem2 != mem);
+	ASSERT(global_arena()->ptrs_tail == PTR(mem2));
+	ASSERT(PTR(mem2)->total_size == MEM_OFFSET + MIN_ALLOC * 2);
+
+	// Sizes beyond the cache always go to the library
+	size_t size = MIN_ALLOC * (MEM_ALLOC_TCACHE_CLASSES + 1);
+	void *mem3 = mem_alloc(size);
+	ASSERT(global_arena()->ptrs_tail == PTR(mem3));
+	ASSERT(mem_free_sized(mem3, size) == 1);
+}
+
+void test_inline_full_cache() {
+	reset_global_arena();
+	enum { COUNT = TCACHE_LIMIT / MEM_ALLOC_TCACHE_COST(1) };
+	void *mems[COUNT + 1];
+	for (size_t i = 0; i <= COUNT; i++)
+		mems[i] = mem_alloc(MIN_ALLOC);
+	bool is_cached = true;
+	for (size_t i = 0; i < COUNT; i++)
+		is_cached = is_cached && mem_free_sized(mems[i], MIN_ALLOC) == 3;
+	ASSERT(is_cached);
+	ASSERT(g_mem_alloc_tcache.size == COUNT * MEM_ALLOC_TCACHE_COST(1));
+
+	// The full cache hands the block to mem_free()
+	ASSERT(mem_free_sized(mems[COUNT], MIN_ALLOC) == 1);
+	ASSERT(!PTR(mems[COUNT])->is_valid);
+	ASSERT(g_mem_alloc_tcache.size == COUNT * MEM_ALLOC_TCACHE_COST(1));
+	ASSERT(mem_alloc(MIN_ALLOC) == mems[COUNT - 1]);
+}
+
+void test_inline_size_zero() {
+	reset_global_arena();
+	void *mem = mem_alloc(0);
+	ASSERT(mem);
+	ASSERT(PTR(mem)->total_size == MEM_OFFSET);
+	ASSERT(mem_free_sized(mem, 0) == 1);
+	ASSERT(!g_mem_alloc_tcache.size);
+	ASSERT(!global_arena()->offset);
+	ASSERT(mem_free_sized(NULL, MIN_ALLOC) == -1);
+}
+
+static void *free_sized_on_thread(void *arg) {
+	mem_free_sized(arg, MIN_ALLOC);
+	return NULL;
+}
+
+void test_inline_exit_hook() {
+	reset_global_arena();
+	void *mem = mem_alloc(MIN_ALLOC);
+
+	// The first push of a thread goes through the library, which releases
+	// the cache when the thread exits
+	pthread_t thread;
+	ASSERT(!pthread_create(&thread, NULL, free_sized_on_thread, mem));
+	ASSERT(!pthread_join(thread, NULL));
+	ASSERT(global_arena()->offset == 0);
+}
+
+int main(void) {
+	test_inline_hit();
+	test_inline_miss();
+	test_inline_full_cache();
+	test_inline_size_zero();
+	test_inline_exit_hook();
+
+	test_print_results();
+	return 0;
+}
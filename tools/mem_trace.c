@@ -0,0 +1,754 @@
+/*
+MIT License
+
+Copyright (c) 2025 broskobandi
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/** \file tools/mem_trace.c
+ * \brief Offline analyzer for trace files written by the mem_alloc library.
+ * \details Usage:
+ * mem_trace stats <file>
+ * mem_trace map <file> [snapshots] [width]
+ * mem_trace replay <file> [rounds]
+ * 'stats' summarizes the events by operation and path. 'map' reconstructs
+ * the occupancy of every arena over time and renders it as a
+ * fragmentation map. If the trace has wrapped around, an arena is only 
+ * rendered from its first checkpoint on. 'replay' runs the events of every
+ * thread against the linked library and reports the time spent. Threads 
+ * are replayed one after another, not concurrently, so remote frees and 
+ * contention of the original run are not reproduced. Blocks still live at
+ * the end of a thread's events are freed outside the timed section. */
+
+#include <mem_alloc.h>
+#include <mem_alloc_trace.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/******************************************************************************
+ * Macro definitions
+ *****************************************************************************/
+
+#define SNAPSHOTS_DEFAULT 8
+#define WIDTH_DEFAULT 64
+#define ROUNDS_DEFAULT 5
+#define NUM_TYPES (MEM_TRACE_CHECKPOINT + 1)
+#define NUM_PATHS (MEM_TRACE_PATH_MOVE + 1)
+#define MAP_EMPTY 0
+#define MAP_TOMBSTONE 1
+
+/** The states of a cell of the fragmentation map. */
+#define CELL_UNUSED 0
+#define CELL_USED 1
+#define CELL_FREE 2
+#define CELL_CACHED 3
+
+/******************************************************************************
+ * Struct definitions
+ *****************************************************************************/
+
+typedef struct trace trace_t;
+typedef struct addr_map addr_map_t;
+typedef struct arena_state arena_state_t;
+typedef struct replay_job replay_job_t;
+
+struct trace {
+	mem_trace_header_t header;
+	mem_trace_event_t *events;
+	size_t count;
+};
+
+/** Open addressing hash map from traced addresses to values. */
+struct addr_map {
+	uint64_t *keys;
+	uint64_t *values;
+	size_t capacity;
+	size_t used;
+};
+
+/** The reconstructed occupancy of a single arena. */
+struct arena_state {
+	uint64_t arena;
+	uint32_t thread;
+	bool is_explicit;
+	unsigned char *cells;
+	bool is_synced;
+	size_t num_events;
+	size_t seen;
+	size_t snapshot;
+	uint64_t peak_offset;
+};
+
+/** The events of a single thread to be replayed. */
+struct replay_job {
+	const trace_t *trace;
+	uint32_t thread;
+	size_t replayed;
+	size_t skipped;
+	double elapsed_ns;
+};
+
+/******************************************************************************
+ * Static globals
+ *****************************************************************************/
+
+static const char *g_type_names[NUM_TYPES] = {
+	"none", "alloc", "free", "realloc", "checkpoint"
+};
+
+static const char *g_path_names[NUM_PATHS] = {
+	"bump", "free_list", "coalesce", "mmap", "tcache",
+	"tail", "in_place", "grow", "move"
+};
+
+/******************************************************************************
+ * Address map
+ *****************************************************************************/
+
+static inline size_t addr_hash(uint64_t key, size_t capacity) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdLU;
+	key ^= key >> 33;
+	return (size_t)key & (capacity - 1);
+}
+
+static void addr_map_init(addr_map_t *map) {
+	map->capacity = 1024;
+	map->used = 0;
+	map->keys = calloc(map->capacity, sizeof(uint64_t));
+	map->values = calloc(map->capacity, sizeof(uint64_t));
+	if (!map->keys || !map->values) {
+		fprintf(stderr, "mem_trace: out of memory\n");
+		exit(1);
+	}
+}
+
+static void addr_map_destroy(addr_map_t *map) {
+	free(map->keys);
+	free(map->values);
+}
+
+static void addr_map_put(addr_map_t *map, uint64_t key, uint64_t value);
+
+static void addr_map_grow(addr_map_t *map) {
+	addr_map_t grown = *map;
+	uint64_t *keys = map->keys;
+	uint64_t *values = map->values;
+	size_t capacity = map->capacity;
+	grown.capacity = capacity * 2;
+	grown.used = 0;
+	grown.keys = calloc(grown.capacity, sizeof(uint64_t));
+	grown.values = calloc(grown.capacity, sizeof(uint64_t));
+	if (!grown.keys || !grown.values) {
+		fprintf(stderr, "mem_trace: out of memory\n");
+		exit(1);
+	}
+	for (size_t i = 0; i < capacity; i++)
+		if (keys[i] > MAP_TOMBSTONE)
+			addr_map_put(&grown, keys[i], values[i]);
+	free(keys);
+	free(values);
+	*map = grown;
+}
+
+static void addr_map_put(addr_map_t *map, uint64_t key, uint64_t value) {
+	if ((map->used + 1) * 2 > map->capacity)
+		addr_map_grow(map);
+	size_t i = addr_hash(key, map->capacity);
+	size_t slot = map->capacity;
+	while (map->keys[i] != MAP_EMPTY) {
+		if (map->keys[i] == key) {
+			map->values[i] = value;
+			return;
+		}
+		if (map->keys[i] == MAP_TOMBSTONE && slot == map->capacity)
+			slot = i;
+		i = (i + 1) & (map->capacity - 1);
+	}
+	if (slot == map->capacity) {
+		slot = i;
+		map->used++;
+	}
+	map->keys[slot] = key;
+	map->values[slot] = value;
+}
+
+static bool addr_map_get(const addr_map_t *map, uint64_t key, uint64_t *value) {
+	size_t i = addr_hash(key, map->capacity);
+	while (map->keys[i] != MAP_EMPTY) {
+		if (map->keys[i] == key) {
+			*value = map->values[i];
+			return true;
+		}
+		i = (i + 1) & (map->capacity - 1);
+	}
+	return false;
+}
+
+static void addr_map_remove(addr_map_t *map, uint64_t key) {
+	size_t i = addr_hash(key, map->capacity);
+	while (map->keys[i] != MAP_EMPTY) {
+		if (map->keys[i] == key) {
+			map->keys[i] = MAP_TOMBSTONE;
+			return;
+		}
+		i = (i + 1) & (map->capacity - 1);
+	}
+}
+
+/******************************************************************************
+ * Trace loading
+ *****************************************************************************/
+
+/** Reads and validates a trace file. The events are stored oldest first,
+ * also if the file has wrapped around.
+ * \param path The path of the trace file.
+ * \param trace A pointer to the trace to be filled.
+ * \return 0 on success, -1 on failure. */
+static int load_trace(const char *path, trace_t *trace) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return -1;
+	}
+	if (fread(&trace->header, sizeof(trace->header), 1, file) != 1 ||
+		memcmp(trace->header.magic, MEM_TRACE_MAGIC, 8) ||
+		trace->header.version != MEM_TRACE_VERSION ||
+		trace->header.event_size != sizeof(mem_trace_event_t)
+	) {
+		fprintf(stderr, "%s: not a mem_alloc trace file\n", path);
+		fclose(file);
+		return -1;
+	}
+	uint64_t capacity = trace->header.capacity;
+	uint64_t count = trace->header.count;
+	size_t num_events = count < capacity ? count : capacity;
+	size_t first = count < capacity ? 0 : count % capacity;
+	trace->events = malloc(
+		(num_events ? num_events : 1) * sizeof(mem_trace_event_t));
+	if (!trace->events) {
+		fprintf(stderr, "mem_trace: out of memory\n");
+		fclose(file);
+		return -1;
+	}
+	size_t tail = num_events - first;
+	trace->count = 0;
+	if (!fseek(file,
+		(long)(sizeof(mem_trace_header_t) + first * sizeof(mem_trace_event_t)),
+		SEEK_SET))
+		trace->count = fread(
+			trace->events, sizeof(mem_trace_event_t), tail, file);
+	if (trace->count == tail && first &&
+		!fseek(file, (long)sizeof(mem_trace_header_t), SEEK_SET))
+		trace->count += fread(
+			&trace->events[tail], sizeof(mem_trace_event_t), first, file);
+	fclose(file);
+	return 0;
+}
+
+/** Finds the earliest and the latest time of the recorded events. Slots 
+ * are filled in the order buffers are flushed, so only the events of a 
+ * single thread are in time order and the first and last slots need not 
+ * hold the extremes.
+ * \param trace A pointer to the trace.
+ * \param first A pointer to the earliest time to be set.
+ * \param last A pointer to the latest time to be set.
+ * \return The number of events that were considered. */
+static size_t time_range(const trace_t *trace, uint64_t *first, uint64_t *last) {
+	size_t num_events = 0;
+	*first = 0;
+	*last = 0;
+	for (size_t i = 0; i < trace->count; i++) {
+		const mem_trace_event_t *event = &trace->events[i];
+		if (event->type == MEM_TRACE_NONE) continue;
+		if (!num_events || event->time_ns < *first) *first = event->time_ns;
+		if (!num_events || event->time_ns > *last) *last = event->time_ns;
+		num_events++;
+	}
+	return num_events;
+}
+
+/******************************************************************************
+ * stats
+ *****************************************************************************/
+
+static int cmd_stats(const trace_t *trace) {
+	size_t counts[NUM_TYPES][NUM_PATHS] = {{0}};
+	size_t nested = 0;
+	uint32_t threads = 0;
+	uint64_t mmap_bytes = 0;
+	uint64_t peak_mmap_bytes = 0;
+	addr_map_t arenas;
+	addr_map_init(&arenas);
+
+	for (size_t i = 0; i < trace->count; i++) {
+		const mem_trace_event_t *event = &trace->events[i];
+		if (event->type == MEM_TRACE_NONE ||
+			event->type >= NUM_TYPES || event->path >= NUM_PATHS)
+			continue;
+		counts[event->type][event->path]++;
+		if (event->flags & MEM_TRACE_FLAG_NESTED) nested++;
+		if (event->thread >= threads) threads = event->thread + 1;
+
+		uint64_t peak = 0;
+		addr_map_get(&arenas, event->arena, &peak);
+		if (event->arena_offset >= peak)
+			addr_map_put(&arenas, event->arena, event->arena_offset);
+
+		if (event->path == MEM_TRACE_PATH_MMAP) {
+			if (event->type == MEM_TRACE_ALLOC)
+				mmap_bytes += event->block_size;
+			else if (mmap_bytes >= event->block_size)
+				mmap_bytes -= event->block_size;
+			if (mmap_bytes > peak_mmap_bytes)
+				peak_mmap_bytes = mmap_bytes;
+		}
+	}
+
+	uint64_t first_ns = 0;
+	uint64_t last_ns = 0;
+	time_range(trace, &first_ns, &last_ns);
+	double span_ms = (double)(last_ns - first_ns) / 1e6;
+	printf("events:      %zu (%zu nested in realloc)\n", trace->count, nested);
+	printf("recorded:    %lu\n", (unsigned long)trace->header.count);
+	printf("overwritten: %lu\n", (unsigned long)trace->header.overwritten);
+	printf("threads:     %u\n", threads);
+	printf("span:        %.3f ms\n", span_ms);
+	printf("arena size:  %lu bytes\n", (unsigned long)trace->header.arena_size);
+	printf("peak mmap:   %lu bytes\n", (unsigned long)peak_mmap_bytes);
+	printf("\n%-10s %-10s %12s\n", "operation", "path", "events");
+	for (size_t type = MEM_TRACE_ALLOC; type < NUM_TYPES; type++)
+		for (size_t path = 0; path < NUM_PATHS; path++)
+			if (counts[type][path])
+				printf("%-10s %-10s %12zu\n",
+					g_type_names[type], g_path_names[path],
+					counts[type][path]);
+	printf("\n%-18s %14s\n", "arena", "peak offset");
+	for (size_t i = 0; i < arenas.capacity; i++)
+		if (arenas.keys[i] > MAP_TOMBSTONE)
+			printf("0x%-16lx %14lu\n",
+				(unsigned long)arenas.keys[i],
+				(unsigned long)arenas.values[i]);
+
+	addr_map_destroy(&arenas);
+	return 0;
+}
+
+/******************************************************************************
+ * map
+ *****************************************************************************/
+
+static arena_state_t *find_arena(
+	arena_state_t *arenas, size_t num_arenas, uint64_t arena) {
+	for (size_t i = 0; i < num_arenas; i++)
+		if (arenas[i].arena == arena)
+			return &arenas[i];
+	return NULL;
+}
+
+static void set_cells(
+	arena_state_t *state, const mem_trace_header_t *header,
+	uint64_t addr, uint64_t block_size, unsigned char cell) {
+	size_t num_cells = header->arena_size / header->min_alloc;
+	uint64_t start = addr - header->mem_offset - state->arena;
+	size_t first = start / header->min_alloc;
+	size_t last = (start + header->mem_offset + block_size) / header->min_alloc;
+	if (start >= header->arena_size) return;
+	if (last > num_cells) last = num_cells;
+	memset(&state->cells[first], cell, last - first);
+}
+
+/** Prints a single row of the fragmentation map of 'state'. */
+static void print_snapshot(
+	const arena_state_t *state, const mem_trace_header_t *header,
+	const mem_trace_event_t *event, uint64_t start_ns, size_t width) {
+	size_t num_cells = header->arena_size / header->min_alloc;
+	size_t in_use = event->arena_offset / header->min_alloc;
+	size_t totals[4] = {0};
+	size_t run = 0;
+	size_t largest_run = 0;
+	for (size_t i = 0; i < in_use && i < num_cells; i++) {
+		unsigned char cell = state->cells[i];
+		totals[cell]++;
+		run = cell == CELL_FREE ? run + 1 : 0;
+		if (run > largest_run) largest_run = run;
+	}
+	double frag = totals[CELL_FREE] ?
+		1.0 - (double)largest_run / (double)totals[CELL_FREE] : 0.0;
+
+	printf("%10.3fms %8lu %5.1f%% %5.1f%% %5.1f%% %5.2f |",
+		(double)(event->time_ns - start_ns) / 1e6,
+		(unsigned long)event->arena_offset,
+		100.0 * (double)totals[CELL_USED] / (double)num_cells,
+		100.0 * (double)totals[CELL_FREE] / (double)num_cells,
+		100.0 * (double)totals[CELL_CACHED] / (double)num_cells,
+		frag);
+	for (size_t col = 0; col < width; col++) {
+		size_t first = col * num_cells / width;
+		size_t last = (col + 1) * num_cells / width;
+		size_t column[4] = {0};
+		for (size_t i = first; i < last; i++)
+			column[i < in_use ? state->cells[i] : CELL_UNUSED]++;
+		char c = ' ';
+		if (column[CELL_USED] + column[CELL_FREE] + column[CELL_CACHED]) {
+			c = '#';
+			if (column[CELL_FREE] > column[CELL_USED]) c = '.';
+			if (column[CELL_CACHED] > column[CELL_USED] &&
+				column[CELL_CACHED] > column[CELL_FREE]) c = '+';
+		}
+		putchar(c);
+	}
+	printf("|\n");
+}
+
+/** Resets the reconstructed state of an arena at the start of a 
+ * checkpoint. */
+static void begin_checkpoint(
+	arena_state_t *state, const mem_trace_header_t *header,
+	addr_map_t *blocks) {
+	memset(state->cells, CELL_UNUSED, header->arena_size / header->min_alloc);
+	for (size_t i = 0; i < blocks->capacity; i++)
+		if (blocks->keys[i] > MAP_TOMBSTONE &&
+			blocks->keys[i] - state->arena < header->arena_size)
+			blocks->keys[i] = MAP_TOMBSTONE;
+	state->is_synced = true;
+}
+
+/** Applies a single event to the reconstructed state of its arena. Events
+ * before the first checkpoint of an arena are ignored if the trace has 
+ * wrapped around. */
+static void apply_event(
+	arena_state_t *state, const mem_trace_header_t *header,
+	addr_map_t *blocks, const mem_trace_event_t *event) {
+	uint64_t block_size = event->block_size;
+	if (event->path == MEM_TRACE_PATH_MMAP) return;
+	if (event->type == MEM_TRACE_CHECKPOINT &&
+		event->path == MEM_TRACE_PATH_TAIL)
+		begin_checkpoint(state, header, blocks);
+	if (!state->is_synced) return;
+	if (event->arena_offset > state->peak_offset)
+		state->peak_offset = event->arena_offset;
+
+	switch (event->type) {
+	case MEM_TRACE_ALLOC:
+		if (event->path == MEM_TRACE_PATH_TCACHE)
+			addr_map_get(blocks, event->addr, &block_size);
+		addr_map_put(blocks, event->addr, block_size);
+		set_cells(state, header, event->addr, block_size, CELL_USED);
+		break;
+	case MEM_TRACE_FREE:
+		addr_map_get(blocks, event->addr, &block_size);
+		if (event->path == MEM_TRACE_PATH_TCACHE) {
+			set_cells(state, header, event->addr, block_size, CELL_CACHED);
+			break;
+		}
+		addr_map_remove(blocks, event->addr);
+		if (event->path == MEM_TRACE_PATH_TAIL) {
+			size_t num_cells = header->arena_size / header->min_alloc;
+			size_t first = event->arena_offset / header->min_alloc;
+			if (first < num_cells)
+				memset(&state->cells[first], CELL_UNUSED, num_cells - first);
+		} else {
+			set_cells(state, header, event->addr, block_size, CELL_FREE);
+		}
+		break;
+	case MEM_TRACE_REALLOC:
+		if (event->path == MEM_TRACE_PATH_GROW) {
+			addr_map_put(blocks, event->addr, block_size);
+			set_cells(state, header, event->addr, block_size, CELL_USED);
+		}
+		break;
+	case MEM_TRACE_CHECKPOINT:
+		if (event->path == MEM_TRACE_PATH_FREE_LIST) {
+			set_cells(state, header, event->addr, block_size, CELL_FREE);
+		} else if (event->path != MEM_TRACE_PATH_TAIL) {
+			addr_map_put(blocks, event->addr, block_size);
+			set_cells(state, header, event->addr, block_size,
+				event->path == MEM_TRACE_PATH_TCACHE ? CELL_CACHED : CELL_USED);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static int cmd_map(const trace_t *trace, size_t snapshots, size_t width) {
+	const mem_trace_header_t *header = &trace->header;
+	size_t num_cells = header->arena_size / header->min_alloc;
+	arena_state_t *arenas = NULL;
+	size_t num_arenas = 0;
+	addr_map_t blocks;
+	addr_map_init(&blocks);
+
+	for (size_t i = 0; i < trace->count; i++) {
+		const mem_trace_event_t *event = &trace->events[i];
+		if (event->type == MEM_TRACE_NONE) continue;
+		arena_state_t *state = find_arena(arenas, num_arenas, event->arena);
+		if (!state) {
+			arena_state_t *grown = realloc(
+				arenas, (num_arenas + 1) * sizeof(arena_state_t));
+			unsigned char *cells = calloc(num_cells, 1);
+			if (!grown || !cells) {
+				fprintf(stderr, "mem_trace: out of memory\n");
+				return 1;
+			}
+			arenas = grown;
+			state = &arenas[num_arenas++];
+			memset(state, 0, sizeof(arena_state_t));
+			state->arena = event->arena;
+			state->thread = event->thread;
+			state->is_explicit = event->flags & MEM_TRACE_FLAG_EXPLICIT_ARENA;
+			state->is_synced = header->count <= header->capacity;
+			state->cells = cells;
+		}
+		state->num_events++;
+	}
+
+	uint64_t start_ns = 0;
+	uint64_t last_ns = 0;
+	time_range(trace, &start_ns, &last_ns);
+	for (size_t a = 0; a < num_arenas; a++) {
+		arena_state_t *state = &arenas[a];
+		printf("%sarena 0x%lx (%s, thread %u, %zu events)\n",
+			a ? "\n" : "", (unsigned long)state->arena,
+			state->is_explicit ? "explicit" : "thread",
+			state->thread, state->num_events);
+		printf("%12s %8s %6s %6s %6s %5s\n",
+			"time", "offset", "used", "free", "cached", "frag");
+		for (size_t i = 0; i < trace->count; i++) {
+			const mem_trace_event_t *event = &trace->events[i];
+			if (event->type == MEM_TRACE_NONE || event->arena != state->arena)
+				continue;
+			apply_event(state, header, &blocks, event);
+			state->seen++;
+			if (event->type != MEM_TRACE_CHECKPOINT &&
+				state->seen * snapshots >= (state->snapshot + 1) * state->num_events) {
+				state->snapshot = state->seen * snapshots / state->num_events;
+				if (state->is_synced)
+					print_snapshot(state, header, event, start_ns, width);
+			}
+		}
+		printf("peak offset: %lu of %lu bytes\n",
+			(unsigned long)state->peak_offset,
+			(unsigned long)header->arena_size);
+		free(state->cells);
+	}
+	printf("\n'#' used  '.' free  '+' thread cache  ' ' unused, "
+		"frag = 1 - largest free run / free bytes\n");
+
+	free(arenas);
+	addr_map_destroy(&blocks);
+	return 0;
+}
+
+/******************************************************************************
+ * replay
+ *****************************************************************************/
+
+static inline double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void *replay_thread(void *arg) {
+	replay_job_t *job = arg;
+	const trace_t *trace = job->trace;
+	addr_map_t ptrs;
+	addr_map_t owners;
+	addr_map_t arenas;
+	addr_map_init(&ptrs);
+	addr_map_init(&owners);
+	addr_map_init(&arenas);
+
+	double start = now_ns();
+	for (size_t i = 0; i < trace->count; i++) {
+		const mem_trace_event_t *event = &trace->events[i];
+		if (event->thread != job->thread || event->type == MEM_TRACE_NONE ||
+			event->type == MEM_TRACE_CHECKPOINT ||
+			(event->flags & MEM_TRACE_FLAG_NESTED))
+			continue;
+
+		mem_arena_t *arena = NULL;
+		if (event->flags & MEM_TRACE_FLAG_EXPLICIT_ARENA) {
+			uint64_t value = 0;
+			if (!addr_map_get(&arenas, event->arena, &value)) {
+				value = (uint64_t)(uintptr_t)mem_arena_new();
+				addr_map_put(&arenas, event->arena, value);
+			}
+			arena = (mem_arena_t*)(uintptr_t)value;
+		}
+
+		uint64_t value = 0;
+		void *mem = NULL;
+		switch (event->type) {
+		case MEM_TRACE_ALLOC:
+			if (arena)
+				mem = mem_arena_alloc(arena, event->request);
+			else if (event->flags & MEM_TRACE_FLAG_TRY)
+				mem = mem_try_alloc(event->request);
+			else
+				mem = mem_alloc(event->request);
+			if (mem)
+				addr_map_put(&ptrs, event->addr, (uint64_t)(uintptr_t)mem);
+			if (mem && arena)
+				addr_map_put(&owners, event->addr, (uint64_t)(uintptr_t)arena);
+			break;
+		case MEM_TRACE_FREE:
+			if (!addr_map_get(&ptrs, event->addr, &value)) {
+				job->skipped++;
+				continue;
+			}
+			mem = (void*)(uintptr_t)value;
+			if (arena)
+				mem_arena_free(arena, mem);
+			else if (event->path == MEM_TRACE_PATH_TCACHE)
+				mem_free_sized(mem, event->request);
+			else
+				mem_free(mem);
+			addr_map_remove(&ptrs, event->addr);
+			addr_map_remove(&owners, event->addr);
+			break;
+		case MEM_TRACE_REALLOC:
+			if (!addr_map_get(&ptrs, event->old_addr, &value)) {
+				job->skipped++;
+				continue;
+			}
+			mem = mem_realloc((void*)(uintptr_t)value, event->request);
+			addr_map_remove(&ptrs, event->old_addr);
+			addr_map_remove(&owners, event->old_addr);
+			if (mem)
+				addr_map_put(&ptrs, event->addr, (uint64_t)(uintptr_t)mem);
+			if (mem && arena)
+				addr_map_put(&owners, event->addr, (uint64_t)(uintptr_t)arena);
+			break;
+		default:
+			break;
+		}
+		job->replayed++;
+	}
+	job->elapsed_ns = now_ns() - start;
+
+	// Blocks the trace never freed, or whose free was overwritten, are
+	// released untimed so every round starts from the same state
+	for (size_t i = 0; i < ptrs.capacity; i++) {
+		if (ptrs.keys[i] <= MAP_TOMBSTONE) continue;
+		void *mem = (void*)(uintptr_t)ptrs.values[i];
+		uint64_t owner = 0;
+		if (addr_map_get(&owners, ptrs.keys[i], &owner))
+			mem_arena_free((mem_arena_t*)(uintptr_t)owner, mem);
+		else
+			mem_free(mem);
+	}
+	for (size_t i = 0; i < arenas.capacity; i++)
+		if (arenas.keys[i] > MAP_TOMBSTONE)
+			mem_arena_delete((mem_arena_t*)(uintptr_t)arenas.values[i]);
+	addr_map_destroy(&ptrs);
+	addr_map_destroy(&owners);
+	addr_map_destroy(&arenas);
+	return NULL;
+}
+
+static int cmd_replay(const trace_t *trace, size_t rounds) {
+	uint32_t threads = 0;
+	for (size_t i = 0; i < trace->count; i++)
+		if (trace->events[i].thread >= threads)
+			threads = trace->events[i].thread + 1;
+
+	double best_ns = 0.0;
+	double total_ns = 0.0;
+	size_t replayed = 0;
+	size_t skipped = 0;
+	for (size_t round = 0; round < rounds; round++) {
+		double round_ns = 0.0;
+		replayed = 0;
+		skipped = 0;
+		for (uint32_t thread = 0; thread < threads; thread++) {
+			replay_job_t job = {trace, thread, 0, 0, 0.0};
+			pthread_t handle;
+			if (pthread_create(&handle, NULL, replay_thread, &job)) {
+				fprintf(stderr, "mem_trace: failed to create thread\n");
+				return 1;
+			}
+			pthread_join(handle, NULL);
+			round_ns += job.elapsed_ns;
+			replayed += job.replayed;
+			skipped += job.skipped;
+		}
+		total_ns += round_ns;
+		if (!round || round_ns < best_ns) best_ns = round_ns;
+	}
+
+	printf("threads:   %u\n", threads);
+	printf("replayed:  %zu events (%zu skipped)\n", replayed, skipped);
+	printf("rounds:    %zu\n", rounds);
+	printf("best:      %.3f ms (%.2f ns/event)\n",
+		best_ns / 1e6, replayed ? best_ns / (double)replayed : 0.0);
+	printf("mean:      %.3f ms\n", total_ns / (double)rounds / 1e6);
+	return 0;
+}
+
+/******************************************************************************
+ * main
+ *****************************************************************************/
+
+static void usage(void) {
+	fprintf(stderr,
+		"usage: mem_trace stats <file>\n"
+		"       mem_trace map <file> [snapshots] [width]\n"
+		"       mem_trace replay <file> [rounds]\n"
+		"replay runs the recorded threads one after another, not concurrently\n");
+}
+
+int main(int argc, char **argv) {
+	// A traced library must not record the replay into a trace file
+	setenv("MEM_ALLOC_TRACE_DISABLE", "1", 1);
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+
+	trace_t trace;
+	if (load_trace(argv[2], &trace)) return 1;
+
+	int result = 1;
+	if (!strcmp(argv[1], "stats")) {
+		result = cmd_stats(&trace);
+	} else if (!strcmp(argv[1], "map")) {
+		size_t snapshots = argc > 3 ? strtoul(argv[3], NULL, 10) : 0;
+		size_t width = argc > 4 ? strtoul(argv[4], NULL, 10) : 0;
+		result = cmd_map(
+			&trace,
+			snapshots ? snapshots : SNAPSHOTS_DEFAULT,
+			width ? width : WIDTH_DEFAULT);
+	} else if (!strcmp(argv[1], "replay")) {
+		size_t rounds = argc > 3 ? strtoul(argv[3], NULL, 10) : 0;
+		result = cmd_replay(&trace, rounds ? rounds : ROUNDS_DEFAULT);
+	} else {
+		usage();
+	}
+
+	free(trace.events);
+	return result;
+}